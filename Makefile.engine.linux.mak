@@ -7,7 +7,7 @@ EXTENSION := .so
 CXX := clang++
 COMPILER_FLAGS := -std=c++17 -g -MD -Werror=vla -fdeclspec -fPIC
 INCLUDE_FLAGS := -Iengine/src -I$(VULKAN_SDK)/include
-LINKER_FLAGS := -g -shared -lvulkan -lxcb -lX11 -lX11-xcb -lm -lxkbcommon -L$(VULKAN_SDK)/lib -L/usr/X11R6/lib, -rpath ,'$$ORIGIN'
+LINKER_FLAGS := -g -shared -lvulkan -lxcb -lX11 -lX11-xcb -lm -lxkbcommon -lxkbcommon-x11 -lxcb-xkb -lpthread -L$(VULKAN_SDK)/lib -L/usr/X11R6/lib, -rpath ,'$$ORIGIN'
 DEFINES := -D_DEBUG -DKEXPORT
 
 # Make does not offer a recursive wildcard function, so here's one:
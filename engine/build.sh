@@ -14,7 +14,7 @@ compilerFlags="-g -std=c++17 -shared -fdeclspec -fPIC"
 # -fms-extensions 
 # -Wall -Werror
 includeFlags="-Isrc -I$VULKAN_SDK/include"
-linkerFlags="-lvulkan -lxcb -lX11 -lX11-xcb -lxkbcommon -L$VULKAN_SDK/lib -L/usr/X11R6/lib"
+linkerFlags="-lvulkan -lxcb -lX11 -lX11-xcb -lxkbcommon -lxkbcommon-x11 -lxcb-xkb -lpthread -L$VULKAN_SDK/lib -L/usr/X11R6/lib"
 defines="-D_DEBUG -DKEXPORT"
 
 echo "Building $assembly..."
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "defines.h"
+#include "core/kmemory.h"
+
+#include <atomic>
+#include <new>
+
+// Size of a cache line, used to keep the producer and consumer cursors apart.
+#define MPSC_QUEUE_CACHE_LINE 64
+
+/**
+ * A bounded lock-free queue for many producer threads and a single consumer thread.
+ * Each cell carries a sequence number telling producers and the consumer whose turn it
+ * is, so a producer claims a cell with a single compare-and-swap on the enqueue cursor
+ * and the consumer never writes to shared state other than the cell it frees. No call
+ * ever blocks or takes a lock; a full queue makes enqueue fail instead.
+ *
+ * T must be trivially copyable.
+ */
+template <typename T>
+class mpsc_queue {
+    typedef struct queue_cell {
+        std::atomic<u64> sequence;
+        T data;
+    } queue_cell;
+
+    queue_cell* cells;
+    u64 mask;
+
+    alignas(MPSC_QUEUE_CACHE_LINE) std::atomic<u64> enqueue_pos;
+    // Only touched by the consumer.
+    alignas(MPSC_QUEUE_CACHE_LINE) u64 dequeue_pos;
+
+public:
+    mpsc_queue() : cells{0}, mask{0}, enqueue_pos{0}, dequeue_pos{0} {}
+
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    ~mpsc_queue() {
+        destroy();
+    }
+
+    /**
+     * Allocates the cells. Must be called before any thread uses the queue.
+     * @param capacity The number of cells. Must be a power of 2.
+     * @returns TRUE on success; otherwise FALSE.
+     */
+    b8 create(u64 capacity) {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            return FALSE;
+        }
+        cells = (queue_cell*)kallocate(sizeof(queue_cell) * capacity, MEMORY_TAG_RING_QUEUE);
+        for (u64 i = 0; i < capacity; ++i) {
+            new (&cells[i].sequence) std::atomic<u64>(i);
+        }
+        mask = capacity - 1;
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos = 0;
+        return TRUE;
+    }
+
+    // Frees the cells. No thread may use the queue during or after this call.
+    void destroy() {
+        if (cells) {
+            kfree(cells, sizeof(queue_cell) * (mask + 1), MEMORY_TAG_RING_QUEUE);
+            cells = 0;
+            mask = 0;
+        }
+    }
+
+    /**
+     * Pushes a value. Safe to call from any number of threads at once.
+     * @returns TRUE if the value was queued; FALSE if the queue is full.
+     */
+    b8 enqueue(const T& value) {
+        queue_cell* cell;
+        u64 pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            u64 sequence = cell->sequence.load(std::memory_order_acquire);
+            i64 diff = (i64)sequence - (i64)pos;
+            if (diff == 0) {
+                // The cell is free for this position; try to claim it.
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The consumer has not freed this cell yet: the queue is full.
+                return FALSE;
+            } else {
+                // Another producer claimed the position first.
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = value;
+        // Publish the value to the consumer.
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return TRUE;
+    }
+
+    /**
+     * Pops the oldest value. Must only be called from the consumer thread.
+     * @returns TRUE if a value was popped; FALSE if the queue is empty.
+     */
+    b8 dequeue(T* out_value) {
+        queue_cell* cell = &cells[dequeue_pos & mask];
+        u64 sequence = cell->sequence.load(std::memory_order_acquire);
+        if ((i64)sequence - (i64)(dequeue_pos + 1) != 0) {
+            // Empty, or the producer of this cell has not finished writing it.
+            return FALSE;
+        }
+
+        *out_value = cell->data;
+        // Hand the cell back to producers for the next lap around the ring.
+        cell->sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+        dequeue_pos++;
+        return TRUE;
+    }
+
+    u64 capacity() const { return mask + 1; }
+};
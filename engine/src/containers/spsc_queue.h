@@ -0,0 +1,106 @@
+#pragma once
+
+#include "defines.h"
+#include "core/kmemory.h"
+
+#include <atomic>
+
+// Size of a cache line, used to keep the producer and consumer cursors apart.
+#define SPSC_QUEUE_CACHE_LINE 64
+
+/**
+ * A bounded lock-free ring for exactly one producer thread and one consumer thread.
+ * Each side owns its cursor and only reads the other one, and each keeps a cached copy
+ * of the other side's cursor that it refreshes only when the ring looks full or empty,
+ * so in the steady state neither side touches the other's cache line. No call ever
+ * blocks or takes a lock; a full queue makes enqueue fail instead.
+ *
+ * T must be trivially copyable.
+ */
+template <typename T>
+class spsc_queue {
+    T* cells;
+    u64 mask;
+
+    // Written by the producer only.
+    alignas(SPSC_QUEUE_CACHE_LINE) std::atomic<u64> write_pos;
+    u64 cached_read_pos;
+    // Written by the consumer only.
+    alignas(SPSC_QUEUE_CACHE_LINE) std::atomic<u64> read_pos;
+    u64 cached_write_pos;
+
+public:
+    spsc_queue() : cells{0}, mask{0}, write_pos{0}, cached_read_pos{0}, read_pos{0}, cached_write_pos{0} {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    ~spsc_queue() {
+        destroy();
+    }
+
+    /**
+     * Allocates the cells. Must be called before either thread uses the queue.
+     * @param capacity The number of cells. Must be a power of 2.
+     * @returns TRUE on success; otherwise FALSE.
+     */
+    b8 create(u64 capacity) {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            return FALSE;
+        }
+        cells = (T*)kallocate(sizeof(T) * capacity, MEMORY_TAG_RING_QUEUE);
+        mask = capacity - 1;
+        write_pos.store(0, std::memory_order_relaxed);
+        read_pos.store(0, std::memory_order_relaxed);
+        cached_read_pos = 0;
+        cached_write_pos = 0;
+        return TRUE;
+    }
+
+    // Frees the cells. Neither thread may use the queue during or after this call.
+    void destroy() {
+        if (cells) {
+            kfree(cells, sizeof(T) * (mask + 1), MEMORY_TAG_RING_QUEUE);
+            cells = 0;
+            mask = 0;
+        }
+    }
+
+    /**
+     * Pushes a value. Must only be called from the producer thread.
+     * @returns TRUE if the value was queued; FALSE if the queue is full.
+     */
+    b8 enqueue(const T& value) {
+        u64 pos = write_pos.load(std::memory_order_relaxed);
+        if (pos - cached_read_pos > mask) {
+            cached_read_pos = read_pos.load(std::memory_order_acquire);
+            if (pos - cached_read_pos > mask) {
+                return FALSE;
+            }
+        }
+        cells[pos & mask] = value;
+        // Publish the value to the consumer.
+        write_pos.store(pos + 1, std::memory_order_release);
+        return TRUE;
+    }
+
+    /**
+     * Pops the oldest value. Must only be called from the consumer thread.
+     * @returns TRUE if a value was popped; FALSE if the queue is empty.
+     */
+    b8 dequeue(T* out_value) {
+        u64 pos = read_pos.load(std::memory_order_relaxed);
+        if (pos == cached_write_pos) {
+            cached_write_pos = write_pos.load(std::memory_order_acquire);
+            if (pos == cached_write_pos) {
+                return FALSE;
+            }
+        }
+        *out_value = cells[pos & mask];
+        // Hand the cell back to the producer.
+        read_pos.store(pos + 1, std::memory_order_release);
+        return TRUE;
+    }
+
+    u64 capacity() const { return mask + 1; }
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "defines.h"
+#include "core/asserts.h"
+#include "platform/platform.h"
+
+#include <new>
+#include <utility>
+
+/**
+ * A growable array backed by reserved virtual memory. The whole address range for
+ * max_length elements is reserved up front, and pages are committed only as the array
+ * grows. Growing therefore never copies, and pointers to elements stay valid for the
+ * lifetime of the element. Reserving is cheap, so max_length can be generous.
+ */
+template <typename T>
+class varray {
+    T* elements;
+    u64 length;
+    u64 max_length;
+    u64 committed_bytes;
+    u64 reserved_bytes;
+
+    // Commits enough pages to hold new_length elements.
+    b8 commit_for(u64 new_length) {
+        u64 needed = new_length * sizeof(T);
+        if (needed <= committed_bytes) {
+            return TRUE;
+        }
+
+        // Grow the committed range geometrically to keep the number of commits low.
+        u64 page_size = platform_get_page_size();
+        u64 target = committed_bytes ? committed_bytes * 2 : page_size;
+        while (target < needed) {
+            target *= 2;
+        }
+        target = (target + page_size - 1) & ~(page_size - 1);
+        if (target > reserved_bytes) {
+            target = reserved_bytes;
+        }
+
+        if (!platform_commit_memory((u8*)elements + committed_bytes, target - committed_bytes)) {
+            return FALSE;
+        }
+        committed_bytes = target;
+        return TRUE;
+    }
+
+public:
+    varray() : elements{0}, length{0}, max_length{0}, committed_bytes{0}, reserved_bytes{0} {}
+
+    varray(const varray&) = delete;
+    varray& operator=(const varray&) = delete;
+
+    ~varray() {
+        destroy();
+    }
+
+    /**
+     * Reserves address space for the array. Must be called before use.
+     * @param m_max_length The most elements the array can ever hold.
+     * @returns TRUE on success; otherwise FALSE.
+     */
+    b8 create(u64 m_max_length) {
+        KASSERT_MSG(!elements, "varray::create called on an array already created.");
+        u64 page_size = platform_get_page_size();
+        reserved_bytes = (m_max_length * sizeof(T) + page_size - 1) & ~(page_size - 1);
+        elements = (T*)platform_reserve_memory(reserved_bytes);
+        if (!elements) {
+            reserved_bytes = 0;
+            return FALSE;
+        }
+        max_length = reserved_bytes / sizeof(T);
+        length = 0;
+        committed_bytes = 0;
+        return TRUE;
+    }
+
+    // Destroys every element and releases the whole reservation.
+    void destroy() {
+        if (!elements) {
+            return;
+        }
+        clear();
+        platform_release_memory(elements, reserved_bytes);
+        elements = 0;
+        max_length = 0;
+        committed_bytes = 0;
+        reserved_bytes = 0;
+    }
+
+    /**
+     * Constructs a new element at the end of the array.
+     * @returns A pointer to the new element, or 0 if the reservation is full.
+     */
+    template <typename... Args>
+    T* emplace(Args&&... args) {
+        if (length >= max_length || !commit_for(length + 1)) {
+            return 0;
+        }
+        T* element = new (&elements[length]) T(std::forward<Args>(args)...);
+        length++;
+        return element;
+    }
+
+    T* push(const T& value) {
+        return emplace(value);
+    }
+
+    // Destroys the last element.
+    void pop() {
+        if (length) {
+            length--;
+            elements[length].~T();
+        }
+    }
+
+    // Destroys every element. Committed pages are kept for reuse.
+    void clear() {
+        while (length) {
+            pop();
+        }
+    }
+
+    // Returns the committed pages beyond the current length to the OS.
+    void shrink() {
+        u64 page_size = platform_get_page_size();
+        u64 keep = (length * sizeof(T) + page_size - 1) & ~(page_size - 1);
+        if (keep < committed_bytes) {
+            platform_decommit_memory((u8*)elements + keep, committed_bytes - keep);
+            committed_bytes = keep;
+        }
+    }
+
+    T& operator[](u64 index) {
+        KASSERT_DEBUG(index < length);
+        return elements[index];
+    }
+
+    const T& operator[](u64 index) const {
+        KASSERT_DEBUG(index < length);
+        return elements[index];
+    }
+
+    u64 size() const { return length; }
+    u64 capacity() const { return max_length; }
+    T* data() { return elements; }
+    T* begin() { return elements; }
+    T* end() { return elements + length; }
+};
@@ -1,12 +1,30 @@
 #include "application.h"
 #include "logger.h"
 
+#include "core/kmemory.h"
 #include "core/event.h"
+#include "core/event_timer.h"
 #include "core/input.h"
-application_state::application_state(Game* g): game_inst{g},is_running{FALSE}, is_suspended{FALSE}, platform{0}, width{0}, height{0}, last_time{0}{};
+#include "core/input_action.h"
+#include "core/input_recording.h"
+
+#include <stdlib.h>
+
+// Default size of the per-frame scratch allocator.
+#define DEFAULT_FRAME_ALLOCATOR_SIZE (4 * 1024 * 1024)
+
+// Default size of the engine heap.
+#define DEFAULT_HEAP_SIZE (256 * 1024 * 1024)
+
+application_state::application_state(Game* g): game_inst{g},is_running{FALSE}, is_suspended{FALSE}, platform{0}, width{0}, height{0}, last_time{0}, frame_count{0}, frame_time_total{0}, frame_time_max{0}, missed_deadlines{0}, wake_late_total_ns{0}, frame_allocator{}{};
 
 application_config::application_config(i16 m_start_pos_x,i16 m_start_pos_y,i16 m_start_width,i16 m_start_height, string m_name):
-start_pos_x{m_start_pos_x}, start_pos_y{m_start_pos_y},start_width{m_start_width}, start_height{m_start_height}, name{m_name} {};
+start_pos_x{m_start_pos_x}, start_pos_y{m_start_pos_y},start_width{m_start_width}, start_height{m_start_height}, name{m_name},
+frame_allocator_size{DEFAULT_FRAME_ALLOCATOR_SIZE}, heap_size{DEFAULT_HEAP_SIZE}, use_system_allocator{FALSE}, use_huge_pages{FALSE}, quit_after_playback{FALSE},
+headless{getenv("KOHI_HEADLESS") != 0}, pump_thread{FALSE}, target_frame_rate{0} {};
+
+// State of the application currently running, used by the exported free functions.
+static application_state* running_state = 0;
 
 Application::Application(i16 start_pos_x,i16 start_pos_y,i16 start_width,i16 start_height, string name):
 app_config(start_pos_x,start_pos_y,start_width,start_height, name), initialized{FALSE}, app_state{0} {};
@@ -24,8 +42,21 @@ b8 Application::application_create(Game* game_inst) {
     app_state.game_inst = game_inst;
 
     // Initialize subsystems.
+    memory_system_config memory_config = {};
+    memory_config.total_alloc_size = app_config.heap_size;
+    memory_config.use_system_allocator = app_config.use_system_allocator;
+    memory_config.use_huge_pages = app_config.use_huge_pages;
+    if (!initialize_memory(memory_config)) {
+        KERROR("Memory system failed initialization. Application cannot continue.");
+        return FALSE;
+    }
     initialize_logging();
-    input_initialize();
+
+    if (!linear_allocator_create(app_config.frame_allocator_size, 0, &app_state.frame_allocator)) {
+        KERROR("Frame allocator failed initialization. Application cannot continue.");
+        return FALSE;
+    }
+    running_state = &app_state;
 
     app_state.is_running = TRUE;
     app_state.is_suspended = FALSE;
@@ -34,6 +65,23 @@ b8 Application::application_create(Game* game_inst) {
         KERROR("Event system failed initialization. Application cannot continue.");
         return FALSE;
     }
+    if(!event_timer_initialize()) {
+        KERROR("Event timer system failed initialization. Application cannot continue.");
+        return FALSE;
+    }
+    // Input sets up coalescing of its events, so it comes after the event system.
+    input_initialize();
+    input_action_initialize();
+    if (!app_config.input_playback_path.empty()) {
+        if (!input_playback_start(app_config.input_playback_path.c_str())) {
+            return FALSE;
+        }
+    } else if (!app_config.input_record_path.empty()) {
+        input_recording_start(app_config.input_record_path.c_str());
+    }
+
+    // Only the final size of a burst of resizes matters.
+    event_set_coalescing(EVENT_CODE_RESIZED, event_coalesce_latest);
 
     event_register(EVENT_CODE_APPLICATION_QUIT, this, application_on_event);
     event_register(EVENT_CODE_KEY_PRESSED, 0, application_on_key);
@@ -45,7 +93,9 @@ b8 Application::application_create(Game* game_inst) {
             app_config.start_pos_x,
             app_config.start_pos_y,
             app_config.start_width,
-            app_config.start_height)) {
+            app_config.start_height,
+            app_config.headless,
+            app_config.pump_thread)) {
         return FALSE;
     }
 
@@ -63,20 +113,43 @@ b8 Application::application_create(Game* game_inst) {
 }
 
 b8 Application::application_run() {
+    // With a target frame rate, each frame ends at a fixed deadline.
+    u64 frame_period_ns = app_config.target_frame_rate ? 1000000000ull / app_config.target_frame_rate : 0;
+    u64 frame_deadline_ns = platform_get_absolute_time_ns() + frame_period_ns;
+    app_state.last_time = platform_get_absolute_time();
+
     while (app_state.is_running) {
+        f64 frame_start = platform_get_absolute_time();
+        f64 delta_time = frame_start - app_state.last_time;
+        app_state.last_time = frame_start;
         if(!platform_pump_messages(&app_state.platform)) {
             app_state.is_running = FALSE;
         }
 
+        // Close the recorded frame, or feed this frame's recorded input during a playback.
+        input_recording_begin_frame();
+        if (app_config.quit_after_playback && input_playback_is_finished()) {
+            app_state.is_running = FALSE;
+        }
+
+        // Dispatch the events queued during the pump, and any posted last frame.
+        event_dispatch_posted();
+
+        // Rebuild the action states from the input gathered by the pump.
+        input_action_update();
+
+        // Fire the timers that came due since the last frame.
+        event_timer_update();
+
         if(!app_state.is_suspended) {
-            if (!app_state.game_inst->update(app_state.game_inst, (f32)0)) {
+            if (!app_state.game_inst->update(app_state.game_inst, (f32)delta_time)) {
                 KFATAL("Game update failed, shutting down.");
                 app_state.is_running = FALSE;
                 break;
             }
 
             // Call the game's render routine.
-            if (!app_state.game_inst->render(app_state.game_inst, (f32)0)) {
+            if (!app_state.game_inst->render(app_state.game_inst, (f32)delta_time)) {
                 KFATAL("Game render failed, shutting down.");
                 app_state.is_running = FALSE;
                 break;
@@ -86,23 +159,83 @@ b8 Application::application_run() {
             // after any input should be recorded; I.E. before this line.
             // As a safety, input is the last thing to be updated before
             // this frame ends.
-            input_update(0);
+            input_update(delta_time);
+
+            // Everything allocated for this frame is released at once.
+            linear_allocator_free_all(&app_state.frame_allocator);
+        }
+
+        // Event payloads are reclaimed wholesale as well.
+        event_end_frame();
+
+        f64 frame_time = platform_get_absolute_time() - frame_start;
+        app_state.frame_count++;
+        app_state.frame_time_total += frame_time;
+        if (frame_time > app_state.frame_time_max) {
+            app_state.frame_time_max = frame_time;
+        }
+
+        if (frame_period_ns) {
+            u64 now_ns = platform_get_absolute_time_ns();
+            if (now_ns < frame_deadline_ns) {
+                platform_sleep_until(frame_deadline_ns);
+                app_state.wake_late_total_ns += platform_get_absolute_time_ns() - frame_deadline_ns;
+                frame_deadline_ns += frame_period_ns;
+            } else {
+                // The frame overran. Start the next period now rather than rush the
+                // following frames to catch up.
+                app_state.missed_deadlines++;
+                frame_deadline_ns = now_ns + frame_period_ns;
+            }
         }
     }
 
     app_state.is_running = FALSE;
+
+    app_state.game_inst->shutdown(app_state.game_inst);
     
     // Shutdown event system.
     event_unregister(EVENT_CODE_APPLICATION_QUIT, this, application_on_event);
     event_unregister(EVENT_CODE_KEY_PRESSED, 0, application_on_key);
     event_unregister(EVENT_CODE_KEY_RELEASED, 0, application_on_key);
+    event_timer_shutdown();
     event_shutdown();
+    input_action_shutdown();
+    input_recording_shutdown();
     input_shutdown();
     platform_shutdown(&app_state.platform);
 
+    if (app_state.frame_count) {
+        KINFO("Ran %llu frames: %.3f ms average, %.3f ms longest.", app_state.frame_count,
+              app_state.frame_time_total * 1000.0 / app_state.frame_count, app_state.frame_time_max * 1000.0);
+    }
+    if (app_config.target_frame_rate && app_state.frame_count) {
+        u64 paced_frames = app_state.frame_count - app_state.missed_deadlines;
+        KINFO("Paced to %u fps: %.2f%% of deadlines missed, waits ended %.1f us late on average.",
+              app_config.target_frame_rate, app_state.missed_deadlines * 100.0 / app_state.frame_count,
+              paced_frames ? app_state.wake_late_total_ns / 1000.0 / paced_frames : 0.0);
+    }
+    KINFO("Frame allocator high water mark: %llu / %llu bytes.",
+          app_state.frame_allocator.high_water_mark, app_state.frame_allocator.total_size);
+    running_state = 0;
+    linear_allocator_destroy(&app_state.frame_allocator);
+    shutdown_memory();
+
     return TRUE;
 }
 
+void* application_frame_allocate(u64 size) {
+    if (!running_state) {
+        KERROR("application_frame_allocate called before the application was created.");
+        return 0;
+    }
+    return linear_allocator_allocate(&running_state->frame_allocator, size);
+}
+
+u64 application_frame_allocator_high_water_mark() {
+    return running_state ? running_state->frame_allocator.high_water_mark : 0;
+}
+
 b8 application_on_event(u16 code, void* sender, void* listener_inst, event_context context) {
     KDEBUG("Event quit called!");
     switch (code) {
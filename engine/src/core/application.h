@@ -3,6 +3,7 @@
 #include "defines.h"
 #include "game_types.h"
 #include "platform/platform.h"
+#include "memory/linear_allocator.h"
 #include <string>
 using namespace std;
 
@@ -14,6 +15,17 @@ typedef struct application_state {
     i16 width;
     i16 height;
     f64 last_time;
+    // Frames run and their total and longest wall time in seconds, to compare runs of
+    // the same input playback between builds.
+    u64 frame_count;
+    f64 frame_time_total;
+    f64 frame_time_max;
+    // Paced frames that overran their deadline, and how late the paced waits ended in
+    // total, in nanoseconds.
+    u64 missed_deadlines;
+    u64 wake_late_total_ns;
+    // Scratch memory for the current frame. Reset at the end of every frame.
+    linear_allocator frame_allocator;
     application_state(Game* instance);
 } application_state;
 
@@ -32,6 +44,37 @@ typedef struct application_config {
 
         // The application name used in windowing, if applicable.
         string name;
+
+        // Size in bytes of the per-frame scratch allocator.
+        u64 frame_allocator_size;
+
+        // Size in bytes of the engine heap reserved at creation.
+        u64 heap_size;
+
+        // Allocate straight from the system instead of the engine heap, for debugging.
+        b8 use_system_allocator;
+
+        // Back the engine heap with huge pages, where the OS allows.
+        b8 use_huge_pages;
+
+        // Record all input to this file, if not empty.
+        string input_record_path;
+
+        // Replay the input recorded in this file instead of taking platform input, if not empty.
+        string input_playback_path;
+
+        // Quit once the playback has played its last frame.
+        b8 quit_after_playback;
+
+        // Run without a window or display server, for servers and benchmark runs. Set by
+        // default when the KOHI_HEADLESS environment variable is.
+        b8 headless;
+
+        // Read window messages on a dedicated thread, where the platform supports it.
+        b8 pump_thread;
+
+        // Frames per second to pace the main loop to, or 0 to run uncapped.
+        u32 target_frame_rate;
         application_config(i16 m_start_pos_x,i16 m_start_pos_y,i16 m_start_width,i16 m_start_height, string m_name);
     } application_config;
 
@@ -51,4 +94,18 @@ public:
     b8 application_run();
 
     application_state* GetState() {return &app_state;}
-};
\ No newline at end of file
+
+    // Configuration used by application_create. Change it before calling it.
+    application_config* GetConfig() {return &app_config;}
+};
+
+/**
+ * Allocates transient memory from the running application's frame allocator. The block
+ * is only valid until the end of the current frame and must not be freed.
+ * @param size The size of the block in bytes.
+ * @returns A pointer to the block, or 0 if the frame allocator is exhausted.
+ */
+KAPI void* application_frame_allocate(u64 size);
+
+// The most frame memory used by a single frame so far, in bytes.
+KAPI u64 application_frame_allocator_high_water_mark();
\ No newline at end of file
@@ -1,80 +1,424 @@
 #include "core/event.h"
 #include "core/logger.h"
+#include "core/kmemory.h"
+#include "containers/varray.h"
+#include "containers/mpsc_queue.h"
+#include "platform/platform.h"
 
-typedef struct registered_event {
-    void* listener;
-    PFN_on_event callback;
-    registered_event();
-    registered_event(void* l, PFN_on_event c);
-} registered_event;
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
-registered_event::registered_event(): listener{0}, callback{0} {};
-registered_event::registered_event(void* l, PFN_on_event c): listener{l}, callback{c} {};
+// Statistics of a single event code, allocated the first time it is fired with
+// statistics enabled.
+typedef struct event_code_stats {
+    u64 fires;
+    u64 handled;
+    // Callbacks invoked over all fires.
+    u64 listener_calls;
+    u64 total_ns;
+    u64 histogram[EVENT_STATS_HISTOGRAM_BUCKETS];
+} event_code_stats;
 
+/**
+ * Registrations for a single event code, kept as a structure of arrays: firing an event
+ * walks the callbacks contiguously and only touches the listener array alongside it.
+ * The slot array maps each registration back to its handle slot. All three arrays live
+ * in one allocation, callbacks first.
+ */
 typedef struct event_code_entry {
-    vector<registered_event*> events;
-    event_code_entry();
+    PFN_on_event* callbacks;
+    void** listeners;
+    u32* slots;
+    u32 count;
+    u32 capacity;
+    // Registrations removed during a fire, left as 0 callbacks until it ends.
+    u32 removed;
+    // Merges posted events of this code within a batch, or 0 to dispatch each one.
+    PFN_on_coalesce coalesce;
+    // Posted events of this code folded into another instead of being dispatched.
+    u64 coalesced;
+    event_code_stats* stats;
 } event_code_entry;
 
+// Where a handle's registration currently lives. Slots are reused through a free list;
+// the generation is bumped on every reuse so stale handles are rejected.
+typedef struct event_listener_slot {
+    u32 generation;
+    // Position in the entry arrays, or the next free slot while unused.
+    u32 position;
+    u16 code;
+    b8 in_use;
+} event_listener_slot;
+
 // This should be more than enough codes...
 #define MAX_MESSAGE_CODES 16384
 
+// Registrations a code can hold before its arrays first grow.
+#define EVENT_ENTRY_INITIAL_CAPACITY 4
+
+// Most registrations that can exist at once, over all codes.
+#define MAX_EVENT_LISTENERS (1 << 20)
+
+// Marks the end of the free slot list.
+#define EVENT_SLOT_NONE 0xFFFFFFFFu
+
+// Capacity of the posted event queue, as a power of 2.
+#define EVENT_QUEUE_CAPACITY_LOG2 12
+#define EVENT_QUEUE_CAPACITY (1 << EVENT_QUEUE_CAPACITY_LOG2)
+
+// Size of each of the two payload arenas, and the alignment of payloads within them.
+#define EVENT_PAYLOAD_ARENA_SIZE (256 * 1024)
+#define EVENT_PAYLOAD_ALIGNMENT 16
+
+// Marks a posted event that carries no payload.
+#define EVENT_PAYLOAD_NONE 0xFF
+
+// Sort keys pack the code above the queue slot, so both must fit in 32 bits.
+STATIC_ASSERT(((u64)MAX_MESSAGE_CODES << EVENT_QUEUE_CAPACITY_LOG2) <= 0x100000000ull, "Event sort key does not fit in 32 bits.");
+
+/**
+ * Transient storage for event payloads. Any thread may bump the offset; the main thread
+ * resets it once the events referencing the arena have been dispatched.
+ */
+typedef struct event_payload_arena {
+    u8* memory;
+    std::atomic<u64> offset;
+    // Payloads in the arena that are still in use: copies being written, and events that
+    // carry one and have not been dispatched yet. The arena is only reset at 0.
+    std::atomic<u32> pending;
+} event_payload_arena;
+
+typedef struct posted_event {
+    u16 code;
+    // Index of the arena holding the payload, or EVENT_PAYLOAD_NONE.
+    u8 payload_arena;
+    void* sender;
+    event_context context;
+} posted_event;
+
 // State structure.
 typedef struct event_system_state {
-    // Lookup table for event codes.
-    event_code_entry registered[MAX_MESSAGE_CODES];
-    b8 is_initialized;
-    event_system_state();
-} event_system_state;
+    // Lookup table for event codes. Holds the index + 1 of the code's entry, or 0 if
+    // nothing was ever registered for it.
+    u16 code_index[MAX_MESSAGE_CODES];
+    // Entries of the codes in use, in order of first registration. Never shrinks, so
+    // indices in code_index stay valid.
+    varray<event_code_entry> entries;
+    // Handle slots of all registrations, and the head of the list of unused ones.
+    varray<event_listener_slot> slots;
+    u32 free_slot;
+
+    // Posted events. Any thread may post; only the main thread dispatches.
+    mpsc_queue<posted_event> queue;
+    // The batch being dispatched, and the keys used to order it by code.
+    posted_event* dispatch_batch;
+    u32* dispatch_keys;
+    // The thread that initialized the system, the only one allowed to fire events.
+    std::thread::id main_thread;
+    // Posted events of all codes folded into another instead of being dispatched.
+    u64 coalesced_total;
+    // Number of fires in progress. While non-zero, registrations are only appended and
+    // removals leave a 0 callback behind, so every fire loop on the stack stays valid.
+    u32 fire_depth;
+    // Set when a removal left a hole to drop once the outermost fire ends.
+    b8 compact_pending;
+    // Payloads are copied into the arena of the current frame. Events posted in one frame
+    // are usually dispatched early in the next, so an arena is normally reset a frame after
+    // its last use; one whose payloads are still pending keeps growing until they are not.
+    event_payload_arena payload_arenas[2];
+    std::atomic<u32> payload_frame;
 
-event_code_entry::event_code_entry(): events{vector<registered_event*>()}{};
+    // Whether event_fire records statistics.
+    b8 stats_enabled;
 
-event_system_state::event_system_state():registered{event_code_entry()}, is_initialized{TRUE}{};
+    b8 is_initialized;
+} event_system_state;
 
 /**
  * Event system internal state.
  */
 static event_system_state state;
 
+static u64 entry_block_size(u32 capacity) {
+    return (u64)capacity * (sizeof(PFN_on_event) + sizeof(void*) + sizeof(u32));
+}
+
+// Grows the arrays of the entry to hold at least one more registration.
+static void entry_grow(event_code_entry* entry) {
+    u32 new_capacity = entry->capacity ? entry->capacity * 2 : EVENT_ENTRY_INITIAL_CAPACITY;
+    PFN_on_event* callbacks = (PFN_on_event*)kallocate(entry_block_size(new_capacity), MEMORY_TAG_EVENT);
+    void** listeners = (void**)(callbacks + new_capacity);
+    u32* slots = (u32*)(listeners + new_capacity);
+
+    if (entry->capacity) {
+        kcopy_memory(callbacks, entry->callbacks, sizeof(PFN_on_event) * entry->count);
+        kcopy_memory(listeners, entry->listeners, sizeof(void*) * entry->count);
+        kcopy_memory(slots, entry->slots, sizeof(u32) * entry->count);
+        kfree(entry->callbacks, entry_block_size(entry->capacity), MEMORY_TAG_EVENT);
+    }
+
+    entry->callbacks = callbacks;
+    entry->listeners = listeners;
+    entry->slots = slots;
+    entry->capacity = new_capacity;
+}
+
+// Removes the registration at the position by moving the last one into its place.
+static void entry_swap_remove(event_code_entry* entry, u32 position) {
+    u32 last = entry->count - 1;
+    if(position != last) {
+        entry->callbacks[position] = entry->callbacks[last];
+        entry->listeners[position] = entry->listeners[last];
+        entry->slots[position] = entry->slots[last];
+        state.slots[entry->slots[position]].position = position;
+    }
+    entry->count--;
+}
+
+// Drops the registrations removed while events were being fired.
+static void event_compact() {
+    for(u64 e = 0; e < state.entries.size(); ++e) {
+        event_code_entry* entry = &state.entries[e];
+        // Walking down means a registration moved into a hole has already been looked at.
+        for(u32 i = entry->count; i > 0 && entry->removed; --i) {
+            if(entry->callbacks[i - 1] == 0) {
+                entry_swap_remove(entry, i - 1);
+                entry->removed--;
+            }
+        }
+    }
+    state.compact_pending = FALSE;
+}
+
+// Removes the registration held by the slot and releases the slot.
+static void event_remove_slot(u32 slot_index) {
+    event_listener_slot* slot = &state.slots[slot_index];
+    event_code_entry* entry = &state.entries[state.code_index[slot->code] - 1];
+    if(state.fire_depth) {
+        // A fire may be walking the arrays; leave a hole for it to skip.
+        entry->callbacks[slot->position] = 0;
+        entry->removed++;
+        state.compact_pending = TRUE;
+    } else {
+        entry_swap_remove(entry, slot->position);
+    }
+
+    slot->generation++;
+    slot->in_use = FALSE;
+    slot->position = state.free_slot;
+    state.free_slot = slot_index;
+}
+
+// Returns the entry of the code, creating it on first use. Returns 0 if out of entries.
+static event_code_entry* entry_get_or_create(u16 code) {
+    if(state.code_index[code] != 0) {
+        return &state.entries[state.code_index[code] - 1];
+    }
+    event_code_entry* entry = state.entries.emplace();
+    if(!entry) {
+        KERROR("Event system ran out of registration entries");
+        return 0;
+    }
+    state.code_index[code] = (u16)state.entries.size();
+    return entry;
+}
+
+/**
+ * Calls the listeners of the entry until one handles the event. Callbacks may register
+ * and unregister listeners of any code: the arrays are re-read after every call
+ * since they can be reallocated, removed registrations are 0 until the fire ends, and
+ * registrations added past the starting count are not called.
+ */
+static inline b8 entry_fire(event_code_entry* entry, u16 code, void* sender, event_context context) {
+    u32 count = entry->count;
+    for(u32 i = 0; i < count; ++i) {
+        PFN_on_event callback = entry->callbacks[i];
+        if(callback && callback(code, sender, entry->listeners[i], context)) {
+            // Message has been handled, do not send to other listeners.
+            return TRUE;
+        }
+    }
+
+    // Not found.
+    return FALSE;
+}
+
+#if EVENT_STATS_ENABLED
+// Fires an event like entry_fire, recording statistics along the way. Kept out of
+// entry_fire so the plain path stays as small as it was.
+KNOINLINE static b8 entry_fire_instrumented(event_code_entry* entry, u16 code, void* sender, event_context context) {
+    if(!entry->stats) {
+        entry->stats = (event_code_stats*)kallocate(sizeof(event_code_stats), MEMORY_TAG_EVENT);
+    }
+    event_code_stats* stats = entry->stats;
+    stats->fires++;
+
+    u32 count = entry->count;
+    for(u32 i = 0; i < count; ++i) {
+        PFN_on_event callback = entry->callbacks[i];
+        if(!callback) {
+            continue;
+        }
+        u64 start = platform_get_ticks();
+        b8 handled = callback(code, sender, entry->listeners[i], context);
+        u64 elapsed = platform_ticks_to_ns(platform_get_ticks() - start);
+
+        stats->listener_calls++;
+        stats->total_ns += elapsed;
+        u32 bucket = elapsed ? 63 - __builtin_clzll(elapsed) : 0;
+        stats->histogram[bucket < EVENT_STATS_HISTOGRAM_BUCKETS ? bucket : EVENT_STATS_HISTOGRAM_BUCKETS - 1]++;
+
+        if(handled) {
+            // Message has been handled, do not send to other listeners.
+            stats->handled++;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+#endif
+
 b8 event_initialize() {
-    if(!state.is_initialized){
+    if(state.is_initialized){
         KWARN("Event system already initialized!");
         return FALSE;
     }
+    if(!state.entries.create(MAX_MESSAGE_CODES) || !state.slots.create(MAX_EVENT_LISTENERS)) {
+        KERROR("Event system failed to reserve its registration table.");
+        state.entries.destroy();
+        return FALSE;
+    }
+    state.free_slot = EVENT_SLOT_NONE;
+    state.queue.create(EVENT_QUEUE_CAPACITY);
+    state.dispatch_batch = (posted_event*)kallocate(sizeof(posted_event) * EVENT_QUEUE_CAPACITY, MEMORY_TAG_EVENT);
+    state.dispatch_keys = (u32*)kallocate(sizeof(u32) * EVENT_QUEUE_CAPACITY, MEMORY_TAG_EVENT);
+    u8* payload_memory = (u8*)kallocate(EVENT_PAYLOAD_ARENA_SIZE * 2, MEMORY_TAG_EVENT);
+    for(u32 i = 0; i < 2; ++i) {
+        state.payload_arenas[i].memory = payload_memory + EVENT_PAYLOAD_ARENA_SIZE * i;
+        state.payload_arenas[i].offset.store(0, std::memory_order_relaxed);
+        state.payload_arenas[i].pending.store(0, std::memory_order_relaxed);
+    }
+    state.payload_frame.store(0, std::memory_order_relaxed);
+    state.main_thread = std::this_thread::get_id();
+    state.is_initialized = TRUE;
     KDEBUG("Event system initialized");
-    state = event_system_state();
     return TRUE;
 }
 
 void event_shutdown() {
-    // Free the events arrays. And objects pointed to should be destroyed on their own.
-    for(u16 i = 0; i < MAX_MESSAGE_CODES; ++i){
-        if(state.registered[i].events.size() != 0) {
-            state.registered[i].events.clear();
+    event_log_stats();
+    if(state.coalesced_total) {
+        KINFO("Event system coalesced %llu posted events", state.coalesced_total);
+        for(u32 code = 0; code < MAX_MESSAGE_CODES; ++code) {
+            u16 index = state.code_index[code];
+            if(index && state.entries[index - 1].coalesced) {
+                KINFO("  code %u: %llu", code, state.entries[index - 1].coalesced);
+            }
+        }
+    }
+
+    // Free the registration arrays. And objects pointed to should be destroyed on their own.
+    for(u64 i = 0; i < state.entries.size(); ++i) {
+        event_code_entry* entry = &state.entries[i];
+        if(entry->capacity) {
+            kfree(entry->callbacks, entry_block_size(entry->capacity), MEMORY_TAG_EVENT);
+        }
+        if(entry->stats) {
+            kfree(entry->stats, sizeof(event_code_stats), MEMORY_TAG_EVENT);
         }
     }
+    state.entries.destroy();
+    state.slots.destroy();
+    kzero_memory(state.code_index, sizeof(state.code_index));
+
+    // Posted events still pending are dropped.
+    state.queue.destroy();
+    kfree(state.dispatch_batch, sizeof(posted_event) * EVENT_QUEUE_CAPACITY, MEMORY_TAG_EVENT);
+    kfree(state.dispatch_keys, sizeof(u32) * EVENT_QUEUE_CAPACITY, MEMORY_TAG_EVENT);
+    state.dispatch_batch = 0;
+    state.dispatch_keys = 0;
+    kfree(state.payload_arenas[0].memory, EVENT_PAYLOAD_ARENA_SIZE * 2, MEMORY_TAG_EVENT);
+    state.payload_arenas[0].memory = 0;
+    state.payload_arenas[1].memory = 0;
+    state.coalesced_total = 0;
+    state.stats_enabled = FALSE;
+    state.is_initialized = FALSE;
 }
 
-b8 event_register(u16 code, void* listener, PFN_on_event on_event) {
-    if(state.is_initialized == FALSE) {
-        return FALSE;
+event_handle event_register(u16 code, void* listener, PFN_on_event on_event) {
+    if(state.is_initialized == FALSE || !on_event) {
+        return EVENT_HANDLE_INVALID;
+    }
+    if(code >= MAX_MESSAGE_CODES) {
+        KWARN("Event code %u is out of range", code);
+        return EVENT_HANDLE_INVALID;
+    }
+
+    event_code_entry* entry = entry_get_or_create(code);
+    if(!entry) {
+        return EVENT_HANDLE_INVALID;
     }
 
-    for(u64 i = 0; i < state.registered[code].events.size(); ++i) {
-        if(state.registered[code].events[i]->listener == listener) {
+#ifdef _DEBUG
+    // Finding a duplicate means walking every listener of the code, which would make
+    // registering many listeners quadratic, so only debug builds look for one.
+    for(u32 i = 0; i < entry->count; ++i) {
+        if(entry->callbacks[i] == on_event && entry->listeners[i] == listener) {
             KWARN("Event already registered");
-            return FALSE;
+            return EVENT_HANDLE_INVALID;
         }
     }
+#endif
 
     // If at this point, no duplicate was found. Proceed with registration.
-    registered_event* event = new registered_event(listener, on_event);
-    //event->listener = listener;
-    //event->callback = on_event;
-    state.registered[code].events.push_back(event);
-    //KDEBUG("Number of events registered for %d: %d",code,state.registered[code].events.size() );
-    //KDEBUG("Event registered!");
+    u32 slot_index;
+    if(state.free_slot != EVENT_SLOT_NONE) {
+        slot_index = state.free_slot;
+        state.free_slot = state.slots[slot_index].position;
+    } else {
+        event_listener_slot* new_slot = state.slots.emplace();
+        if(!new_slot) {
+            KERROR("Event system ran out of listener slots");
+            return EVENT_HANDLE_INVALID;
+        }
+        // Generation 0 is never used, so no handle is ever EVENT_HANDLE_INVALID.
+        new_slot->generation = 1;
+        slot_index = (u32)(state.slots.size() - 1);
+    }
+
+    // Registrations added during a fire are appended past the end the fire loop walks
+    // to, so they only see later events.
+    if(entry->count == entry->capacity) {
+        entry_grow(entry);
+    }
+    entry->callbacks[entry->count] = on_event;
+    entry->listeners[entry->count] = listener;
+    entry->slots[entry->count] = slot_index;
+
+    event_listener_slot* slot = &state.slots[slot_index];
+    slot->code = code;
+    slot->position = entry->count;
+    slot->in_use = TRUE;
+    entry->count++;
 
+    return ((event_handle)slot->generation << 32) | slot_index;
+}
+
+b8 event_unregister(event_handle handle) {
+    if(state.is_initialized == FALSE) {
+        return FALSE;
+    }
+
+    u32 slot_index = (u32)handle;
+    u32 generation = (u32)(handle >> 32);
+    if(slot_index >= state.slots.size() || !state.slots[slot_index].in_use || state.slots[slot_index].generation != generation) {
+        KWARN("Event not unregistered due to a stale or invalid handle");
+        return FALSE;
+    }
+
+    event_remove_slot(slot_index);
     return TRUE;
 }
 
@@ -84,16 +428,16 @@ b8 event_unregister(u16 code, void* listener, PFN_on_event on_event) {
     }
 
     // On nothing is registered for the code, boot out.
-    if(state.registered[code].events.size() == 0) {
+    if(code >= MAX_MESSAGE_CODES || state.code_index[code] == 0 || state.entries[state.code_index[code] - 1].count == 0) {
         KWARN("Event not unregistered due to none exist");
         return FALSE;
     }
 
-    for(u64 i = 0; i < state.registered[code].events.size(); ++i) {
-        registered_event* e = state.registered[code].events[i];
-        if(e->listener == listener && e->callback == on_event) {
-            // Found one, remove it
-            state.registered[code].events.erase(state.registered[code].events.begin()+i);
+    event_code_entry* entry = &state.entries[state.code_index[code] - 1];
+    for(u32 i = 0; i < entry->count; ++i) {
+        if(entry->listeners[i] == listener && entry->callbacks[i] == on_event) {
+            // Found one, remove it.
+            event_remove_slot(entry->slots[i]);
             return TRUE;
         }
     }
@@ -104,23 +448,283 @@ b8 event_unregister(u16 code, void* listener, PFN_on_event on_event) {
 }
 
 b8 event_fire(u16 code, void* sender, event_context context) {
-    if(state.is_initialized == FALSE) {
+    if(state.is_initialized == FALSE || code >= MAX_MESSAGE_CODES) {
         return FALSE;
     }
 
     // If nothing is registered for the code, boot out.
-    if(state.registered[code].events.size() == 0) {
+    u16 index = state.code_index[code];
+    if(index == 0) {
         return FALSE;
     }
 
-    for(u64 i = 0; i < state.registered[code].events.size(); ++i) {
-        registered_event* e = state.registered[code].events[i];
-        if(e->callback(code, sender, e->listener, context)) {
-            // Message has been handled, do not send to other listeners.
-            return TRUE;
+    event_code_entry* entry = state.entries.data() + (index - 1);
+    state.fire_depth++;
+#if EVENT_STATS_ENABLED
+    b8 handled = state.stats_enabled ? entry_fire_instrumented(entry, code, sender, context) : entry_fire(entry, code, sender, context);
+#else
+    b8 handled = entry_fire(entry, code, sender, context);
+#endif
+    state.fire_depth--;
+    if(state.fire_depth == 0 && state.compact_pending) {
+        event_compact();
+    }
+    return handled;
+}
+
+// Drops the hold an event has on the arena its payload lives in.
+static void event_release_payload(u8 payload_arena) {
+    if(payload_arena != EVENT_PAYLOAD_NONE) {
+        state.payload_arenas[payload_arena].pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+// Queues an event. The hold on payload_arena passes to the queued event, or is released
+// here if the event is fired or dropped instead.
+static b8 event_enqueue(u16 code, void* sender, event_context context, u8 payload_arena) {
+    posted_event posted;
+    posted.code = code;
+    posted.payload_arena = payload_arena;
+    posted.sender = sender;
+    posted.context = context;
+    if(state.queue.enqueue(posted)) {
+        return TRUE;
+    }
+
+    // Listeners may only run on the main thread, so other threads have to drop the event.
+    if(std::this_thread::get_id() != state.main_thread) {
+        KWARN("Event queue full, dropping event %u posted from another thread", code);
+        event_release_payload(payload_arena);
+        return FALSE;
+    }
+    KWARN("Event queue full, firing event %u immediately", code);
+    b8 handled = event_fire(code, sender, context);
+    event_release_payload(payload_arena);
+    return handled;
+}
+
+b8 event_post(u16 code, void* sender, event_context context) {
+    if(state.is_initialized == FALSE || code >= MAX_MESSAGE_CODES) {
+        return FALSE;
+    }
+    return event_enqueue(code, sender, context, EVENT_PAYLOAD_NONE);
+}
+
+void event_dispatch_posted() {
+    if(state.is_initialized == FALSE) {
+        return;
+    }
+
+    // Take everything posted so far as this batch. Events posted by listeners during the
+    // dispatch below land in the queue for the next call.
+    u32 count = 0;
+    while(count < EVENT_QUEUE_CAPACITY && state.queue.dequeue(&state.dispatch_batch[count])) {
+        count++;
+    }
+    if(count == 0) {
+        return;
+    }
+
+    // The batch index in the low bits keeps posting order within a code.
+    for(u32 i = 0; i < count; ++i) {
+        state.dispatch_keys[i] = ((u32)state.dispatch_batch[i].code << EVENT_QUEUE_CAPACITY_LOG2) | i;
+    }
+    std::sort(state.dispatch_keys, state.dispatch_keys + count);
+
+    for(u32 i = 0; i < count; ++i) {
+        posted_event* posted = &state.dispatch_batch[state.dispatch_keys[i] & (EVENT_QUEUE_CAPACITY - 1)];
+
+        // Events of one code are adjacent after the sort, so a coalescing code folds the
+        // whole run into its first event, in posting order, and is dispatched once.
+        u16 index = state.code_index[posted->code];
+        event_code_entry* entry = index ? state.entries.data() + (index - 1) : 0;
+        u32 run_end = i + 1;
+        if(entry && entry->coalesce) {
+            while(run_end < count && (state.dispatch_keys[run_end] >> EVENT_QUEUE_CAPACITY_LOG2) == posted->code) {
+                const posted_event* incoming = &state.dispatch_batch[state.dispatch_keys[run_end] & (EVENT_QUEUE_CAPACITY - 1)];
+                entry->coalesce(posted->code, &posted->context, &incoming->context);
+                posted->sender = incoming->sender;
+                run_end++;
+            }
+            entry->coalesced += run_end - i - 1;
+            state.coalesced_total += run_end - i - 1;
+        }
+
+        event_fire(posted->code, posted->sender, posted->context);
+
+        // The folded context may point at the payload of any event in the run, so the
+        // whole run keeps its arenas until the fire is over.
+        for(u32 j = i; j < run_end; ++j) {
+            event_release_payload(state.dispatch_batch[state.dispatch_keys[j] & (EVENT_QUEUE_CAPACITY - 1)].payload_arena);
         }
+        i = run_end - 1;
     }
+}
 
-    // Not found.
-    return FALSE;
+/**
+ * Copies a payload into the current arena and points the context at the copy. On success
+ * the copy holds the arena, whose index is written to out_arena, until it is released
+ * with event_release_payload.
+ */
+static b8 event_copy_payload(u16 code, const void* data, u64 size, event_context* out_context, u8* out_arena) {
+    // Hold the arena first, then check it is still the current one. event_end_frame only
+    // resets an arena that nothing holds, right before making it current, so a hold taken
+    // while the arena is current can never see it reset. A producer that read the frame
+    // just before a switch retries with the new arena.
+    u32 frame;
+    event_payload_arena* arena;
+    for(;;) {
+        frame = state.payload_frame.load();
+        arena = &state.payload_arenas[frame];
+        arena->pending.fetch_add(1);
+        if(state.payload_frame.load() == frame) {
+            break;
+        }
+        arena->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    u64 aligned_size = (size + EVENT_PAYLOAD_ALIGNMENT - 1) & ~((u64)EVENT_PAYLOAD_ALIGNMENT - 1);
+    u64 offset = arena->offset.fetch_add(aligned_size, std::memory_order_relaxed);
+    if(offset + aligned_size > EVENT_PAYLOAD_ARENA_SIZE) {
+        KWARN("Event payload arena full, dropping %llu byte payload of event %u", size, code);
+        arena->pending.fetch_sub(1, std::memory_order_release);
+        return FALSE;
+    }
+
+    void* copy = arena->memory + offset;
+    kcopy_memory(copy, data, size);
+    out_context->data.u64[0] = (u64)copy;
+    out_context->data.u64[1] = size;
+    *out_arena = (u8)frame;
+    return TRUE;
+}
+
+b8 event_fire_payload(u16 code, void* sender, const void* data, u64 size) {
+    if(state.is_initialized == FALSE || code >= MAX_MESSAGE_CODES) {
+        return FALSE;
+    }
+    event_context context;
+    u8 payload_arena;
+    if(!event_copy_payload(code, data, size, &context, &payload_arena)) {
+        return FALSE;
+    }
+    b8 handled = event_fire(code, sender, context);
+    event_release_payload(payload_arena);
+    return handled;
+}
+
+b8 event_post_payload(u16 code, void* sender, const void* data, u64 size) {
+    if(state.is_initialized == FALSE || code >= MAX_MESSAGE_CODES) {
+        return FALSE;
+    }
+    event_context context;
+    u8 payload_arena;
+    if(!event_copy_payload(code, data, size, &context, &payload_arena)) {
+        return FALSE;
+    }
+    return event_enqueue(code, sender, context, payload_arena);
+}
+
+void event_end_frame() {
+    if(state.is_initialized == FALSE) {
+        return;
+    }
+    // The other arena normally held the payloads dispatched at the start of this frame.
+    // Reset it before switching, so no producer ever bumps an arena that is being reset.
+    // If it still has pending payloads, such as an event posted too late for this frame's
+    // dispatch, it is left to grow and reset at a later frame instead.
+    u32 next = state.payload_frame.load(std::memory_order_relaxed) ^ 1;
+    event_payload_arena* arena = &state.payload_arenas[next];
+    if(arena->pending.load() == 0) {
+        arena->offset.store(0, std::memory_order_relaxed);
+    }
+    state.payload_frame.store(next);
+}
+
+b8 event_set_coalescing(u16 code, PFN_on_coalesce coalesce) {
+    if(state.is_initialized == FALSE) {
+        return FALSE;
+    }
+    if(code >= MAX_MESSAGE_CODES) {
+        KWARN("Event code %u is out of range", code);
+        return FALSE;
+    }
+    event_code_entry* entry = entry_get_or_create(code);
+    if(!entry) {
+        return FALSE;
+    }
+    entry->coalesce = coalesce;
+    return TRUE;
+}
+
+void event_coalesce_latest(u16, event_context* pending, const event_context* incoming) {
+    *pending = *incoming;
+}
+
+u64 event_get_coalesced_count(u16 code) {
+    if(state.is_initialized == FALSE || code >= MAX_MESSAGE_CODES || state.code_index[code] == 0) {
+        return 0;
+    }
+    return state.entries[state.code_index[code] - 1].coalesced;
+}
+
+u64 event_get_coalesced_total() {
+    return state.coalesced_total;
+}
+
+void event_set_stats_enabled(b8 enabled) {
+#if EVENT_STATS_ENABLED
+    state.stats_enabled = enabled;
+#else
+    if(enabled) {
+        KWARN("Event statistics are compiled out; build with EVENT_STATS_ENABLED 1 to record them.");
+    }
+#endif
+}
+
+void event_log_stats() {
+    if(state.is_initialized == FALSE) {
+        return;
+    }
+
+    b8 header_logged = FALSE;
+    for(u32 code = 0; code < MAX_MESSAGE_CODES; ++code) {
+        u16 index = state.code_index[code];
+        if(index == 0 || !state.entries[index - 1].stats || state.entries[index - 1].stats->fires == 0) {
+            continue;
+        }
+        const event_code_entry* entry = &state.entries[index - 1];
+        const event_code_stats* stats = entry->stats;
+        if(!header_logged) {
+            KINFO("Event statistics:");
+            header_logged = TRUE;
+        }
+
+        f64 handled_percent = stats->fires ? 100.0 * stats->handled / stats->fires : 0.0;
+        f64 calls_per_fire = stats->fires ? (f64)stats->listener_calls / stats->fires : 0.0;
+        f64 average_ns = stats->listener_calls ? (f64)stats->total_ns / stats->listener_calls : 0.0;
+        KINFO("  code %u: %llu fires, %.1f%% handled, %u listeners, %.2f calls/fire, %.1fns/call",
+              code, stats->fires, handled_percent, entry->count, calls_per_fire, average_ns);
+
+        // Only the non-empty buckets, as "lower bound in ns: count".
+        char histogram[512];
+        u64 offset = 0;
+        for(u32 i = 0; i < EVENT_STATS_HISTOGRAM_BUCKETS && offset < sizeof(histogram); ++i) {
+            if(stats->histogram[i]) {
+                offset += snprintf(histogram + offset, sizeof(histogram) - offset, " %llu:%llu", 1ull << i, stats->histogram[i]);
+            }
+        }
+        if(offset) {
+            KINFO("    ns histogram:%s", histogram);
+        }
+    }
+}
+
+void event_reset_stats() {
+    for(u64 i = 0; i < state.entries.size(); ++i) {
+        event_code_stats* stats = state.entries[i].stats;
+        if(stats) {
+            kzero_memory(stats, sizeof(event_code_stats));
+        }
+    }
 }
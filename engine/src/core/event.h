@@ -1,9 +1,6 @@
 #pragma once
-#include <vector>
 #include "defines.h"
 
-using namespace std;
-
 typedef struct event_context {
     // 128 bytes
     union {
@@ -28,22 +25,62 @@ typedef struct event_context {
 // Should return true if handled.
 typedef b8 (*PFN_on_event)(u16 code, void* sender, void* listener_inst, event_context data);
 
+/**
+ * Identifies a single registration. Holds a slot index in the low 32 bits and the slot's
+ * generation in the high 32 bits, so a handle whose registration is gone is rejected
+ * even after its slot has been reused.
+ */
+typedef u64 event_handle;
+
+// Never returned for a successful registration.
+#define EVENT_HANDLE_INVALID 0
+
+// Compiles the event statistics in. Even when compiled in, nothing is recorded until
+// event_set_stats_enabled is called, and event_fire only pays a single branch.
+#ifndef EVENT_STATS_ENABLED
+#define EVENT_STATS_ENABLED 1
+#endif
+
+// Number of log2 buckets in the per-code callback time histograms, from 1ns up.
+#define EVENT_STATS_HISTOGRAM_BUCKETS 32
+
+/**
+ * Merges a posted event into an earlier posted event of the same code.
+ * @param code The event code of both events.
+ * @param pending The earlier event, to be updated in place. Only this one is dispatched.
+ * @param incoming The later event, discarded after the call.
+ */
+typedef void (*PFN_on_coalesce)(u16 code, event_context* pending, const event_context* incoming);
+
 b8 event_initialize();
 void event_shutdown();
 
 /**
- * Register to listen for when events are sent with the provided code. Events with duplicate
- * listener/callback combos will not be registered again and will cause this to return FALSE.
+ * Register to listen for when events are sent with the provided code. Debug builds refuse
+ * duplicate listener/callback combos and return EVENT_HANDLE_INVALID; release builds do
+ * not check, so registering a combo twice calls it twice. Listeners registered from inside
+ * a callback of the same code do not receive the event being fired.
  * @param code The event code to listen for.
  * @param listener A pointer to a listener instance. Can be 0/NULL.
  * @param on_event The callback function pointer to be invoked when the event code is fired.
- * @returns TRUE if the event is successfully registered; otherwise false.
+ * @returns A handle to the registration; EVENT_HANDLE_INVALID on failure.
+ */
+KAPI event_handle event_register(u16 code, void* listener, PFN_on_event on_event);
+
+/**
+ * Removes the registration the handle refers to in constant time. Registrations are
+ * removed by moving the last one of the code into their place, so the order in which
+ * listeners are called changes. Safe to call from any event callback, including for the
+ * listener being called.
+ * @param handle A handle returned by event_register.
+ * @returns TRUE if the registration was removed; FALSE if the handle is stale or invalid.
  */
-KAPI b8 event_register(u16 code, void* listener, PFN_on_event on_event);
+KAPI b8 event_unregister(event_handle handle);
 
 /**
  * Unregister from listening for when events are sent with the provided code. If no matching
- * registration is found, this function returns FALSE.
+ * registration is found, this function returns FALSE. Searches the registrations of the
+ * code; prefer unregistering by handle when there are many.
  * @param code The event code to stop listening for.
  * @param listener A pointer to a listener instance. Can be 0/NULL.
  * @param on_event The callback function pointer to be unregistered.
@@ -54,6 +91,7 @@ KAPI b8 event_unregister(u16 code, void* listener, PFN_on_event on_event);
 /**
  * Fires an event to listeners of the given code. If an event handler returns 
  * TRUE, the event is considered handled and is not passed on to any more listeners.
+ * Must be called from the main thread; other threads use event_post.
  * @param code The event code to fire.
  * @param sender A pointer to the sender. Can be 0/NULL.
  * @param data The event data.
@@ -61,6 +99,97 @@ KAPI b8 event_unregister(u16 code, void* listener, PFN_on_event on_event);
  */
 KAPI b8 event_fire(u16 code, void* sender, event_context context);
 
+/**
+ * Queues an event to be fired to listeners of the given code at the next call to
+ * event_dispatch_posted, once per frame. Unlike event_fire this returns immediately and
+ * does not nest listener callbacks inside the caller. Use event_fire for events whose
+ * order relative to other codes matters, since posted events are dispatched grouped by code.
+ *
+ * Safe to call from any thread; the queue is lock-free. Listeners always run on the main
+ * thread. If the queue is full, the event is fired immediately when posted from the main
+ * thread and dropped otherwise.
+ * @param code The event code to post.
+ * @param sender A pointer to the sender. Can be 0/NULL.
+ * @param context The event data.
+ * @returns TRUE if the event was queued or handled; otherwise FALSE.
+ */
+KAPI b8 event_post(u16 code, void* sender, event_context context);
+
+/**
+ * Fires an event carrying a payload of any size. The payload is copied into transient
+ * storage owned by the event system, and listeners receive a pointer to the copy and its
+ * size in the context:
+ *     const void* data = (const void*)context.data.u64[0];
+ *     u64 size = context.data.u64[1];
+ * The copy lives until the end of the next frame; listeners that need it longer must copy it.
+ * Must be called from the main thread.
+ * @param code The event code to fire.
+ * @param sender A pointer to the sender. Can be 0/NULL.
+ * @param data The payload to copy.
+ * @param size The size of the payload in bytes.
+ * @returns TRUE if handled, otherwise FALSE. Also FALSE if the transient storage is full.
+ */
+KAPI b8 event_fire_payload(u16 code, void* sender, const void* data, u64 size);
+
+/**
+ * Queues an event carrying a payload of any size. See event_fire_payload for how listeners
+ * read it and event_post for when it is dispatched. Safe to call from any thread.
+ * @param code The event code to post.
+ * @param sender A pointer to the sender. Can be 0/NULL.
+ * @param data The payload to copy.
+ * @param size The size of the payload in bytes.
+ * @returns TRUE if the event was queued or handled; otherwise FALSE.
+ */
+KAPI b8 event_post_payload(u16 code, void* sender, const void* data, u64 size);
+
+/**
+ * Fires every event posted so far, in ascending code order and in posting order within
+ * a code. Events posted by listeners during the dispatch are left for the next call.
+ * Must be called from the main thread.
+ */
+void event_dispatch_posted();
+
+/**
+ * Reclaims the payload storage of events dispatched during this frame. Called once at the
+ * end of every frame, on the main thread.
+ */
+void event_end_frame();
+
+/**
+ * Sets how posted events of the given code are coalesced. When set, all events of the
+ * code posted since the last dispatch are merged into one with the given function, in
+ * posting order, and listeners are called once with the result. Only posted events are
+ * coalesced; events sent with event_fire, such as key and button presses, are always
+ * dispatched one by one and in order.
+ * @param code The event code to configure.
+ * @param coalesce The merge function, such as event_coalesce_latest, or 0 to disable.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 event_set_coalescing(u16 code, PFN_on_coalesce coalesce);
+
+// Coalescing function that keeps the latest event, for states such as positions and sizes.
+KAPI void event_coalesce_latest(u16 code, event_context* pending, const event_context* incoming);
+
+// Number of posted events of the given code merged away by coalescing.
+KAPI u64 event_get_coalesced_count(u16 code);
+
+// Number of posted events of all codes merged away by coalescing.
+KAPI u64 event_get_coalesced_total();
+
+/**
+ * Starts or stops recording statistics in event_fire: per code fire counts, listener
+ * calls, how many fires were handled, and a histogram of callback times where bucket i
+ * counts callbacks that took [2^i, 2^(i+1)) nanoseconds. Does nothing if the statistics
+ * are compiled out with EVENT_STATS_ENABLED 0.
+ */
+KAPI void event_set_stats_enabled(b8 enabled);
+
+// Logs the statistics recorded so far. Also done by event_shutdown.
+KAPI void event_log_stats();
+
+// Clears the statistics recorded so far.
+KAPI void event_reset_stats();
+
 // System internal event codes. Application should use codes beyond 255.
 typedef enum system_event_code {
     // Shuts the application down on the next frame.
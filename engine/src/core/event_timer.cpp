@@ -0,0 +1,298 @@
+#include "core/event_timer.h"
+#include "core/logger.h"
+#include "core/kmemory.h"
+#include "containers/varray.h"
+#include "platform/platform.h"
+
+// The wheel advances in ticks of one millisecond.
+#define EVENT_TIMER_TICKS_PER_SECOND 1000.0
+#define EVENT_TIMER_NS_PER_TICK 1000000ull
+
+// Each level of the wheel has 2^EVENT_TIMER_SLOT_BITS slots; a slot of level n spans
+// 2^(n * EVENT_TIMER_SLOT_BITS) ticks. Four levels cover about 4.6 hours; timers further
+// out wait in the last slot range and are placed again as it comes around.
+#define EVENT_TIMER_SLOT_BITS 6
+#define EVENT_TIMER_SLOT_COUNT (1 << EVENT_TIMER_SLOT_BITS)
+#define EVENT_TIMER_SLOT_MASK (EVENT_TIMER_SLOT_COUNT - 1)
+#define EVENT_TIMER_LEVEL_COUNT 4
+#define EVENT_TIMER_MAX_DELTA (1ull << (EVENT_TIMER_SLOT_BITS * EVENT_TIMER_LEVEL_COUNT))
+
+// Most timers that can be scheduled at once.
+#define MAX_EVENT_TIMERS (1 << 20)
+
+// Ends timer lists and the free list.
+#define EVENT_TIMER_NONE 0xFFFFFFFFu
+
+typedef enum event_timer_status {
+    EVENT_TIMER_STATUS_FREE,
+    // Linked into a slot of the wheel.
+    EVENT_TIMER_STATUS_PENDING,
+    // Taken off the wheel while its event is being fired.
+    EVENT_TIMER_STATUS_FIRING,
+    // Cancelled from inside its own event; freed once the fire returns.
+    EVENT_TIMER_STATUS_CANCELLED
+} event_timer_status;
+
+typedef struct event_timer {
+    // Tick at which the timer fires.
+    u64 expires;
+    // Ticks between fires, or 0 for a one-shot timer.
+    u64 interval;
+    void* sender;
+    event_context context;
+    // Neighbours in the slot list, or the next free timer while unused.
+    u32 next;
+    u32 prev;
+    u32 generation;
+    u16 code;
+    u8 status;
+    // Level and slot of the list the timer is in, to unlink it in constant time.
+    u8 level;
+    u8 slot;
+} event_timer;
+
+typedef struct event_timer_system_state {
+    varray<event_timer> timers;
+    u32 free_timer;
+    u32 pending_count;
+
+    // First timer of each slot list.
+    u32 slots[EVENT_TIMER_LEVEL_COUNT][EVENT_TIMER_SLOT_COUNT];
+    // The last tick processed, and the clock reading it counts from.
+    u64 current_tick;
+    u64 start_ns;
+
+    b8 is_initialized;
+} event_timer_system_state;
+
+static event_timer_system_state state;
+
+// Links the timer into the slot its expiry falls in, relative to the current tick.
+static void timer_link(u32 index) {
+    event_timer* timer = &state.timers[index];
+    u64 delta = timer->expires - state.current_tick;
+    u64 expires = timer->expires;
+    if (delta >= EVENT_TIMER_MAX_DELTA) {
+        // Too far out for the wheel; park it in the furthest slot and place it again later.
+        expires = state.current_tick + EVENT_TIMER_MAX_DELTA - 1;
+        delta = EVENT_TIMER_MAX_DELTA - 1;
+    }
+
+    u8 level = 0;
+    while (delta >= (1ull << (EVENT_TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    u8 slot = (u8)((expires >> (EVENT_TIMER_SLOT_BITS * level)) & EVENT_TIMER_SLOT_MASK);
+
+    u32* head = &state.slots[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = EVENT_TIMER_NONE;
+    timer->next = *head;
+    if (*head != EVENT_TIMER_NONE) {
+        state.timers[*head].prev = index;
+    }
+    *head = index;
+}
+
+static void timer_unlink(u32 index) {
+    event_timer* timer = &state.timers[index];
+    if (timer->prev != EVENT_TIMER_NONE) {
+        state.timers[timer->prev].next = timer->next;
+    } else {
+        state.slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next != EVENT_TIMER_NONE) {
+        state.timers[timer->next].prev = timer->prev;
+    }
+}
+
+static void timer_free(u32 index) {
+    event_timer* timer = &state.timers[index];
+    timer->generation++;
+    timer->status = EVENT_TIMER_STATUS_FREE;
+    timer->next = state.free_timer;
+    state.free_timer = index;
+    state.pending_count--;
+}
+
+// Moves every timer of a slot of a higher level down to where it now belongs.
+static void timer_cascade(u32 level, u32 slot) {
+    u32 index = state.slots[level][slot];
+    state.slots[level][slot] = EVENT_TIMER_NONE;
+    while (index != EVENT_TIMER_NONE) {
+        u32 next = state.timers[index].next;
+        timer_link(index);
+        index = next;
+    }
+}
+
+static u64 seconds_to_ticks(f64 seconds) {
+    if (seconds <= 0.0) {
+        return 0;
+    }
+    // Round up so a timer never fires before its delay has passed, with some slack so a
+    // delay of a whole number of milliseconds is not pushed to the next one by float error.
+    return (u64)(seconds * EVENT_TIMER_TICKS_PER_SECOND + 0.999);
+}
+
+static event_timer_handle timer_schedule(u64 delay_ticks, u64 interval_ticks, u16 code, void* sender, event_context context) {
+    if (state.is_initialized == FALSE) {
+        return EVENT_TIMER_HANDLE_INVALID;
+    }
+
+    u32 index;
+    if (state.free_timer != EVENT_TIMER_NONE) {
+        index = state.free_timer;
+        state.free_timer = state.timers[index].next;
+    } else {
+        event_timer* new_timer = state.timers.emplace();
+        if (!new_timer) {
+            KERROR("Event timer system ran out of timers");
+            return EVENT_TIMER_HANDLE_INVALID;
+        }
+        // Generation 0 is never used, so no handle is ever EVENT_TIMER_HANDLE_INVALID.
+        new_timer->generation = 1;
+        index = (u32)(state.timers.size() - 1);
+    }
+
+    event_timer* timer = &state.timers[index];
+    // The current tick has already been processed, so the earliest a timer can fire is the next.
+    timer->expires = state.current_tick + (delay_ticks ? delay_ticks : 1);
+    timer->interval = interval_ticks;
+    timer->sender = sender;
+    timer->context = context;
+    timer->code = code;
+    timer->status = EVENT_TIMER_STATUS_PENDING;
+    timer_link(index);
+    state.pending_count++;
+
+    return ((event_timer_handle)timer->generation << 32) | index;
+}
+
+b8 event_timer_initialize() {
+    if (state.is_initialized) {
+        KWARN("Event timer system already initialized!");
+        return FALSE;
+    }
+    if (!state.timers.create(MAX_EVENT_TIMERS)) {
+        KERROR("Event timer system failed to reserve its timer table.");
+        return FALSE;
+    }
+    kset_memory(state.slots, 0xFF, sizeof(state.slots));
+    state.free_timer = EVENT_TIMER_NONE;
+    state.pending_count = 0;
+    state.current_tick = 0;
+    state.start_ns = platform_get_absolute_time_ns();
+    state.is_initialized = TRUE;
+    KDEBUG("Event timer system initialized");
+    return TRUE;
+}
+
+void event_timer_shutdown() {
+    if (state.pending_count) {
+        KDEBUG("Event timer system shut down with %u timers pending", state.pending_count);
+    }
+    state.timers.destroy();
+    state.is_initialized = FALSE;
+}
+
+void event_timer_update() {
+    if (state.is_initialized == FALSE) {
+        return;
+    }
+
+    u64 target_tick = (platform_get_absolute_time_ns() - state.start_ns) / EVENT_TIMER_NS_PER_TICK;
+    if (state.pending_count == 0) {
+        // Nothing can expire; skip straight to the present.
+        if (target_tick > state.current_tick) {
+            state.current_tick = target_tick;
+        }
+        return;
+    }
+
+    while (state.current_tick < target_tick) {
+        state.current_tick++;
+        u64 tick = state.current_tick;
+
+        // When a level wraps around, the next slot of the level above comes due and is
+        // spread over the levels below it.
+        for (u32 level = 1; level < EVENT_TIMER_LEVEL_COUNT; ++level) {
+            if ((tick & ((1ull << (EVENT_TIMER_SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            timer_cascade(level, (u32)((tick >> (EVENT_TIMER_SLOT_BITS * level)) & EVENT_TIMER_SLOT_MASK));
+        }
+
+        // Everything in the level 0 slot of this tick expires now. Callbacks may schedule
+        // and cancel timers; new ones always land in later slots.
+        u32* head = &state.slots[0][tick & EVENT_TIMER_SLOT_MASK];
+        while (*head != EVENT_TIMER_NONE) {
+            u32 index = *head;
+            timer_unlink(index);
+            event_timer* timer = &state.timers[index];
+            timer->status = EVENT_TIMER_STATUS_FIRING;
+
+            event_fire(timer->code, timer->sender, timer->context);
+
+            // The array may have grown while firing, but never moves.
+            timer = &state.timers[index];
+            if (timer->status == EVENT_TIMER_STATUS_FIRING && timer->interval) {
+                timer->expires += timer->interval;
+                timer->status = EVENT_TIMER_STATUS_PENDING;
+                timer_link(index);
+            } else {
+                timer_free(index);
+            }
+        }
+
+        if (state.pending_count == 0) {
+            state.current_tick = target_tick;
+        }
+    }
+}
+
+event_timer_handle event_fire_after(f64 delay_seconds, u16 code, void* sender, event_context context) {
+    return timer_schedule(seconds_to_ticks(delay_seconds), 0, code, sender, context);
+}
+
+event_timer_handle event_fire_every(f64 interval_seconds, u16 code, void* sender, event_context context) {
+    u64 interval = seconds_to_ticks(interval_seconds);
+    if (interval == 0) {
+        interval = 1;
+    }
+    return timer_schedule(interval, interval, code, sender, context);
+}
+
+b8 event_timer_cancel(event_timer_handle handle) {
+    if (state.is_initialized == FALSE) {
+        return FALSE;
+    }
+
+    u32 index = (u32)handle;
+    u32 generation = (u32)(handle >> 32);
+    if (index >= state.timers.size()) {
+        return FALSE;
+    }
+    event_timer* timer = &state.timers[index];
+    if (timer->generation != generation) {
+        return FALSE;
+    }
+
+    switch (timer->status) {
+        case EVENT_TIMER_STATUS_PENDING:
+            timer_unlink(index);
+            timer_free(index);
+            return TRUE;
+        case EVENT_TIMER_STATUS_FIRING:
+            // Its event is on the stack; event_timer_update frees it once the fire returns.
+            timer->status = EVENT_TIMER_STATUS_CANCELLED;
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+u32 event_timer_pending_count() {
+    return state.pending_count;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "defines.h"
+#include "core/event.h"
+
+/**
+ * Identifies a scheduled timer. Holds a slot index in the low 32 bits and the slot's
+ * generation in the high 32 bits, so a handle to a timer that has fired or been
+ * cancelled is rejected even after its slot has been reused.
+ */
+typedef u64 event_timer_handle;
+
+// Never returned for a successfully scheduled timer.
+#define EVENT_TIMER_HANDLE_INVALID 0
+
+b8 event_timer_initialize();
+void event_timer_shutdown();
+
+/**
+ * Advances the timers to the current time, firing every timer that has expired since the
+ * last call in order of expiry. Called once per frame by the application, on the main thread.
+ */
+void event_timer_update();
+
+/**
+ * Fires an event once after the given delay. The delay is counted from the last timer
+ * update, i.e. from the start of the current frame, with millisecond resolution. Timers
+ * are checked once per frame, so the event fires during the first update at or after
+ * it is due. Must be called from the main thread.
+ * @param delay_seconds How long to wait before firing.
+ * @param code The event code to fire.
+ * @param sender A pointer to the sender. Can be 0/NULL.
+ * @param context The event data.
+ * @returns A handle to cancel the timer with; EVENT_TIMER_HANDLE_INVALID on failure.
+ */
+KAPI event_timer_handle event_fire_after(f64 delay_seconds, u16 code, void* sender, event_context context);
+
+/**
+ * Fires an event repeatedly at the given interval until cancelled. The first fire is one
+ * interval from now. If a frame takes longer than the interval, the missed fires happen
+ * back to back during the next update, so the count of fires keeps up with time.
+ * Must be called from the main thread.
+ * @param interval_seconds Time between fires. Rounded up to at least one millisecond.
+ * @param code The event code to fire.
+ * @param sender A pointer to the sender. Can be 0/NULL.
+ * @param context The event data.
+ * @returns A handle to cancel the timer with; EVENT_TIMER_HANDLE_INVALID on failure.
+ */
+KAPI event_timer_handle event_fire_every(f64 interval_seconds, u16 code, void* sender, event_context context);
+
+/**
+ * Cancels a scheduled timer in constant time. Safe to call from an event callback,
+ * including one fired by the timer being cancelled.
+ * @returns TRUE if the timer was cancelled; FALSE if the handle is stale or invalid.
+ */
+KAPI b8 event_timer_cancel(event_timer_handle handle);
+
+// Number of timers currently scheduled.
+KAPI u32 event_timer_pending_count();
@@ -1,16 +1,49 @@
 #include "core/input.h"
 #include "core/event.h"
 #include "core/logger.h"
+#include "core/input_recording.h"
+#include "platform/platform.h"
 
 input_state::input_state(): keyboard_current{0}, keyboard_previous{0}, mouse_current{0}, mouse_previous{0}, initialized{FALSE}{}
 
 // Internal input state
 static input_state state{};
 
+// Raw events in arrival order. write_index counts every event ever recorded; the slot of
+// event i is i & (INPUT_EVENT_RING_CAPACITY - 1).
+typedef struct input_event_ring {
+    input_event events[INPUT_EVENT_RING_CAPACITY];
+    u64 write_index;
+} input_event_ring;
+
+static input_event_ring event_ring;
+
+static void input_record_event(input_event_type type, b8 pressed, u16 code, i16 x, i16 y, u32 os_time, f64 time) {
+    input_event* event = &event_ring.events[event_ring.write_index & (INPUT_EVENT_RING_CAPACITY - 1)];
+    event->time = time != 0 ? time : platform_get_absolute_time();
+    event->os_time = os_time;
+    event->type = (u8)type;
+    event->pressed = pressed;
+    event->code = code;
+    event->x = x;
+    event->y = y;
+    event_ring.write_index++;
+    input_recording_capture(event);
+}
+
+// Adds up the wheel deltas of a frame, clamped to the range of the context field.
+static void input_coalesce_wheel(u16 code, event_context* pending, const event_context* incoming) {
+    i32 z_delta = (i32)pending->data.i8[0] + (i32)incoming->data.i8[0];
+    pending->data.i8[0] = (i8)(z_delta > 127 ? 127 : (z_delta < -128 ? -128 : z_delta));
+}
+
 void input_initialize() {
     if(state.initialized){
         return;
     }
+    // Motion and wheel events are posted at device rate, so merge them to one per frame.
+    event_set_coalescing(EVENT_CODE_MOUSE_MOVED, event_coalesce_latest);
+    event_set_coalescing(EVENT_CODE_MOUSE_WHEEL, input_coalesce_wheel);
     state.initialized = TRUE;
     KINFO("Input subsystem initialized.");
 }
@@ -19,6 +52,7 @@ void input_shutdown() {
     // TODO: Add shutdown routines when needed.
     state.initialized = FALSE;
     state = input_state();
+    event_ring.write_index = 0;
 }
 
 void input_update(f64 delta_time) {
@@ -31,11 +65,21 @@ void input_update(f64 delta_time) {
     state.mouse_previous = state.mouse_current;
 }
 
-void input_process_key(keys key, b8 pressed) {
+void input_process_key(keys key, b8 pressed, u32 os_time, f64 time) {
+    // A playback owns the input state; drop what the platform sends meanwhile.
+    if (input_playback_blocks_platform()) {
+        return;
+    }
+    if ((u32)key >= KEY_BITSET_WORDS * 64) {
+        return;
+    }
     // Only handle this if the state actually changed.
-    if (state.keyboard_current.keys[key] != pressed) {
+    u64* word = &state.keyboard_current.keys.words[key >> 6];
+    u64 bit = 1ull << (key & 63);
+    if (((*word & bit) != 0) != (pressed != 0)) {
         // Update internal state.
-        state.keyboard_current.keys[key] = pressed;
+        *word ^= bit;
+        input_record_event(INPUT_EVENT_KEY, pressed, (u16)key, 0, 0, os_time, time);
 
         // Fire off an event for immediate processing.
         event_context context;
@@ -44,10 +88,19 @@ void input_process_key(keys key, b8 pressed) {
     }
 }
 
-void input_process_button(buttons button, b8 pressed) {
+void input_process_button(buttons button, b8 pressed, u32 os_time, f64 time) {
+    // A playback owns the input state; drop what the platform sends meanwhile.
+    if (input_playback_blocks_platform()) {
+        return;
+    }
+    if ((u32)button >= BUTTON_MAX_BUTTONS) {
+        return;
+    }
     // If the state changed, fire an event.
-    if (state.mouse_current.buttons[button] != pressed) {
-        state.mouse_current.buttons[button] = pressed;
+    u32 bit = 1u << button;
+    if (((state.mouse_current.buttons & bit) != 0) != (pressed != 0)) {
+        state.mouse_current.buttons ^= bit;
+        input_record_event(INPUT_EVENT_BUTTON, pressed, (u16)button, 0, 0, os_time, time);
 
         // Fire the event.
         event_context context;
@@ -56,7 +109,11 @@ void input_process_button(buttons button, b8 pressed) {
     }
 }
 
-void input_process_mouse_move(i16 x, i16 y) {
+void input_process_mouse_move(i16 x, i16 y, u32 os_time, f64 time) {
+    // A playback owns the input state; drop what the platform sends meanwhile.
+    if (input_playback_blocks_platform()) {
+        return;
+    }
     // Only process if actually different
     if (state.mouse_current.x != x || state.mouse_current.y != y) {
         // NOTE: Enable this if debugging.
@@ -65,50 +122,80 @@ void input_process_mouse_move(i16 x, i16 y) {
         // Update internal state.
         state.mouse_current.x = x;
         state.mouse_current.y = y;
+        input_record_event(INPUT_EVENT_MOUSE_MOVE, FALSE, 0, x, y, os_time, time);
 
-        // Fire the event.
+        // Queue the event; it is dispatched once per frame.
         event_context context;
         context.data.u16[0] = x;
         context.data.u16[1] = y;
-        event_fire(EVENT_CODE_MOUSE_MOVED, 0, context);
+        event_post(EVENT_CODE_MOUSE_MOVED, 0, context);
     }
 }
 
-void input_process_mouse_wheel(i8 z_delta) {
+void input_process_mouse_wheel(i8 z_delta, u32 os_time, f64 time) {
+    // A playback owns the input state; drop what the platform sends meanwhile.
+    if (input_playback_blocks_platform()) {
+        return;
+    }
     // NOTE: no internal state to update.
+    input_record_event(INPUT_EVENT_MOUSE_WHEEL, FALSE, 0, z_delta, 0, os_time, time);
 
-    // Fire the event.
+    // Queue the event; it is dispatched once per frame.
     event_context context;
     context.data.u8[0] = z_delta;
-    event_fire(EVENT_CODE_MOUSE_WHEEL, 0, context);
+    event_post(EVENT_CODE_MOUSE_WHEEL, 0, context);
+}
+
+u64 input_get_event_cursor() {
+    return event_ring.write_index;
+}
+
+u32 input_read_events(u64* cursor, input_event* out_events, u32 max_events) {
+    u64 read_index = *cursor;
+    if (read_index > event_ring.write_index) {
+        // A cursor from before a shutdown; start over from the present.
+        read_index = event_ring.write_index;
+    }
+    if (event_ring.write_index - read_index > INPUT_EVENT_RING_CAPACITY) {
+        // The oldest unread events have been overwritten.
+        read_index = event_ring.write_index - INPUT_EVENT_RING_CAPACITY;
+    }
+
+    u32 count = 0;
+    while (read_index < event_ring.write_index && count < max_events) {
+        out_events[count++] = event_ring.events[read_index & (INPUT_EVENT_RING_CAPACITY - 1)];
+        read_index++;
+    }
+    *cursor = read_index;
+    return count;
 }
 
 b8 input_is_key_down(keys key) {
     if (!state.initialized) {
         return FALSE;
     }
-    return state.keyboard_current.keys[key] == TRUE;
+    return key_bitset_test(&state.keyboard_current.keys, key) == TRUE;
 }
 
 b8 input_is_key_up(keys key) {
     if (!state.initialized) {
         return TRUE;
     }
-    return state.keyboard_current.keys[key] == FALSE;
+    return key_bitset_test(&state.keyboard_current.keys, key) == FALSE;
 }
 
 b8 input_was_key_down(keys key) {
     if (!state.initialized) {
         return FALSE;
     }
-    return state.keyboard_previous.keys[key] == TRUE;
+    return key_bitset_test(&state.keyboard_previous.keys, key) == TRUE;
 }
 
 b8 input_was_key_up(keys key) {
     if (!state.initialized) {
         return TRUE;
     }
-    return state.keyboard_previous.keys[key] == FALSE;
+    return key_bitset_test(&state.keyboard_previous.keys, key) == FALSE;
 }
 
 // mouse input
@@ -116,28 +203,77 @@ b8 input_is_button_down(buttons button) {
     if (!state.initialized) {
         return FALSE;
     }
-    return state.mouse_current.buttons[button] == TRUE;
+    return ((state.mouse_current.buttons >> button) & 1) == TRUE;
 }
 
 b8 input_is_button_up(buttons button) {
     if (!state.initialized) {
         return TRUE;
     }
-    return state.mouse_current.buttons[button] == FALSE;
+    return ((state.mouse_current.buttons >> button) & 1) == FALSE;
 }
 
 b8 input_was_button_down(buttons button) {
     if (!state.initialized) {
         return FALSE;
     }
-    return state.mouse_previous.buttons[button] == TRUE;
+    return ((state.mouse_previous.buttons >> button) & 1) == TRUE;
 }
 
 b8 input_was_button_up(buttons button) {
     if (!state.initialized) {
         return TRUE;
     }
-    return state.mouse_previous.buttons[button] == FALSE;
+    return ((state.mouse_previous.buttons >> button) & 1) == FALSE;
+}
+
+b8 input_any_key_down() {
+    const u64* current = state.keyboard_current.keys.words;
+    return (current[0] | current[1] | current[2] | current[3]) != 0;
+}
+
+b8 input_any_key_pressed() {
+    const u64* current = state.keyboard_current.keys.words;
+    const u64* previous = state.keyboard_previous.keys.words;
+    u64 pressed = 0;
+    for (u32 i = 0; i < KEY_BITSET_WORDS; ++i) {
+        pressed |= current[i] & ~previous[i];
+    }
+    return pressed != 0;
+}
+
+void input_get_keys_pressed(key_bitset* out_keys) {
+    for (u32 i = 0; i < KEY_BITSET_WORDS; ++i) {
+        out_keys->words[i] = state.keyboard_current.keys.words[i] & ~state.keyboard_previous.keys.words[i];
+    }
+}
+
+void input_get_keys_released(key_bitset* out_keys) {
+    for (u32 i = 0; i < KEY_BITSET_WORDS; ++i) {
+        out_keys->words[i] = state.keyboard_previous.keys.words[i] & ~state.keyboard_current.keys.words[i];
+    }
+}
+
+void input_get_keys_changed(key_bitset* out_keys) {
+    for (u32 i = 0; i < KEY_BITSET_WORDS; ++i) {
+        out_keys->words[i] = state.keyboard_current.keys.words[i] ^ state.keyboard_previous.keys.words[i];
+    }
+}
+
+void input_get_keys_down(key_bitset* out_keys) {
+    *out_keys = state.keyboard_current.keys;
+}
+
+u32 input_get_buttons_down() {
+    return state.mouse_current.buttons;
+}
+
+u32 input_get_buttons_pressed() {
+    return state.mouse_current.buttons & ~state.mouse_previous.buttons;
+}
+
+u32 input_get_buttons_released() {
+    return state.mouse_previous.buttons & ~state.mouse_current.buttons;
 }
 
 void input_get_mouse_position(i32* x, i32* y) {
@@ -142,16 +142,55 @@ typedef enum keys {
     KEYS_MAX_KEYS
 } keys;
 
+// Number of 64-bit words in a key_bitset.
+#define KEY_BITSET_WORDS 4
+
+// One bit per key code, bit (key & 63) of word (key >> 6).
+typedef struct key_bitset {
+    u64 words[KEY_BITSET_WORDS];
+} key_bitset;
+
 typedef struct keyboard_state {
-    b8 keys[256];
+    key_bitset keys;
 } keyboard_state;
 
 typedef struct mouse_state {
     i16 x;
     i16 y;
-    u8 buttons[BUTTON_MAX_BUTTONS];
+    // One bit per button, bit 0 being BUTTON_LEFT.
+    u32 buttons;
 } mouse_state;
 
+typedef enum input_event_type {
+    INPUT_EVENT_KEY,
+    INPUT_EVENT_BUTTON,
+    INPUT_EVENT_MOUSE_MOVE,
+    INPUT_EVENT_MOUSE_WHEEL
+} input_event_type;
+
+/**
+ * A single raw input event, as recorded into the input event ring.
+ */
+typedef struct input_event {
+    // When the engine received the event, on the platform_get_absolute_time clock.
+    f64 time;
+    // The timestamp the OS attached to the event in milliseconds, or 0 if it had none.
+    // Its origin is OS-defined (X server time, GetMessageTime), so only differences matter.
+    u32 os_time;
+    // An input_event_type.
+    u8 type;
+    // For keys and buttons: TRUE if pressed, FALSE if released.
+    b8 pressed;
+    // The key code or button, for keys and buttons.
+    u16 code;
+    // The position for mouse moves; x holds the delta for wheel events.
+    i16 x;
+    i16 y;
+} input_event;
+
+// Number of events the ring holds before the oldest are overwritten. Must be a power of 2.
+#define INPUT_EVENT_RING_CAPACITY 1024
+
 typedef struct input_state {
     keyboard_state keyboard_current;
     keyboard_state keyboard_previous;
@@ -165,22 +204,86 @@ void input_initialize();
 void input_shutdown();
 void input_update(f64 delta_time);
 
+// TRUE if the key's bit is set.
+inline b8 key_bitset_test(const key_bitset* set, u32 key) {
+    return (set->words[key >> 6] >> (key & 63)) & 1;
+}
+
+/**
+ * Finds the first key at or after the given one whose bit is set. Iterate with:
+ *     for (u32 key = key_bitset_next(&set, 0); key < 256; key = key_bitset_next(&set, key + 1))
+ * @returns The key code, or 256 if there is none.
+ */
+inline u32 key_bitset_next(const key_bitset* set, u32 from) {
+    for (u32 word = from >> 6; word < KEY_BITSET_WORDS; ++word) {
+        u64 bits = set->words[word];
+        if (word == (from >> 6)) {
+            // Drop the keys before from in its own word.
+            bits &= ~0ull << (from & 63);
+        }
+        if (bits) {
+            return (word << 6) + (u32)__builtin_ctzll(bits);
+        }
+    }
+    return KEY_BITSET_WORDS * 64;
+}
+
 // keyboard input
 KAPI b8 input_is_key_down(keys key);
 KAPI b8 input_is_key_up(keys key);
 KAPI b8 input_was_key_down(keys key);
 KAPI b8 input_was_key_up(keys key);
 
-void input_process_key(keys key, b8 pressed);
+// TRUE if any key is currently down.
+KAPI b8 input_any_key_down();
+// TRUE if any key went down since the last frame.
+KAPI b8 input_any_key_pressed();
+
+// Keys that are down now but were not last frame.
+KAPI void input_get_keys_pressed(key_bitset* out_keys);
+// Keys that were down last frame but are not now.
+KAPI void input_get_keys_released(key_bitset* out_keys);
+// Keys whose state changed since last frame; iterate them with key_bitset_next.
+KAPI void input_get_keys_changed(key_bitset* out_keys);
+// All keys currently down.
+KAPI void input_get_keys_down(key_bitset* out_keys);
+
+/**
+ * Returns the cursor just past the latest recorded input event. Start reading from it
+ * to receive only the events that arrive afterwards.
+ */
+KAPI u64 input_get_event_cursor();
+
+/**
+ * Copies the input events recorded since the cursor, oldest first, and advances the cursor
+ * past them. Every reader keeps its own cursor, so several systems can read the same
+ * events. Nothing is allocated. If the reader fell more than INPUT_EVENT_RING_CAPACITY
+ * events behind, the overwritten ones are skipped.
+ * @param cursor The reader's cursor; 0 or a value from input_get_event_cursor to start.
+ * @param out_events An array to copy the events into.
+ * @param max_events The size of out_events.
+ * @returns The number of events copied. Call again while it equals max_events.
+ */
+KAPI u32 input_read_events(u64* cursor, input_event* out_events, u32 max_events);
+
+// os_time is the OS timestamp of the event in milliseconds, if the platform has one.
+// time is when the platform received the event, if it was read ahead of processing;
+// 0 stamps the event with the current time.
+void input_process_key(keys key, b8 pressed, u32 os_time = 0, f64 time = 0);
 
 // mouse input
 KAPI b8 input_is_button_down(buttons button);
 KAPI b8 input_is_button_up(buttons button);
 KAPI b8 input_was_button_down(buttons button);
 KAPI b8 input_was_button_up(buttons button);
+// Buttons currently down, one bit per button.
+KAPI u32 input_get_buttons_down();
+// Buttons that went down / up since the last frame, one bit per button.
+KAPI u32 input_get_buttons_pressed();
+KAPI u32 input_get_buttons_released();
 KAPI void input_get_mouse_position(i32* x, i32* y);
 KAPI void input_get_previous_mouse_position(i32* x, i32* y);
 
-void input_process_button(buttons button, b8 pressed);
-void input_process_mouse_move(i16 x, i16 y);
-void input_process_mouse_wheel(i8 z_delta);
+void input_process_button(buttons button, b8 pressed, u32 os_time = 0, f64 time = 0);
+void input_process_mouse_move(i16 x, i16 y, u32 os_time = 0, f64 time = 0);
+void input_process_mouse_wheel(i8 z_delta, u32 os_time = 0, f64 time = 0);
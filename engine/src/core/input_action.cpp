@@ -0,0 +1,232 @@
+#include "core/input_action.h"
+#include "core/logger.h"
+#include "core/kmemory.h"
+
+// Keys take sources 0-255 and mouse buttons the 32 after them.
+#define INPUT_ACTION_KEY_SOURCES (KEY_BITSET_WORDS * 64)
+#define INPUT_ACTION_SOURCE_COUNT (INPUT_ACTION_KEY_SOURCES + 32)
+
+// Most bindings that can exist at once, over all actions.
+#define MAX_INPUT_BINDINGS 4096
+
+// INPUT_ACTION_DOWN in each byte of a word of states.
+#define INPUT_ACTION_LANES_DOWN 0x0101010101010101ull
+STATIC_ASSERT(MAX_INPUT_ACTIONS % 8 == 0, "Action states are processed eight at a time.");
+
+typedef struct input_binding {
+    u16 source;
+    u16 action;
+    u8 modifiers;
+} input_binding;
+
+typedef struct input_action_system_state {
+    // Bindings as added, in no particular order.
+    input_binding bindings[MAX_INPUT_BINDINGS];
+    u32 binding_count;
+    // Set when bindings changed since the table was compiled.
+    b8 dirty;
+
+    // The compiled table: the bindings of source s are entries source_offsets[s] up to
+    // source_offsets[s + 1] of the two arrays below.
+    u16 source_offsets[INPUT_ACTION_SOURCE_COUNT + 1];
+    u16 compiled_actions[MAX_INPUT_BINDINGS];
+    u8 compiled_modifiers[MAX_INPUT_BINDINGS];
+
+    // The modifier each key stands for, if any, and the keys of each modifier.
+    u8 key_modifiers[INPUT_ACTION_KEY_SOURCES];
+    key_bitset modifier_keys[3];
+
+    // State of every action, and one past the highest action ever bound. Aligned so it
+    // can be processed as 64-bit words.
+    alignas(8) u8 states[MAX_INPUT_ACTIONS];
+    u32 action_count;
+
+    b8 is_initialized;
+} input_action_system_state;
+
+static input_action_system_state state;
+
+static void input_action_add_modifier_key(u32 key, u32 modifier_index) {
+    state.key_modifiers[key] = (u8)(1 << modifier_index);
+    state.modifier_keys[modifier_index].words[key >> 6] |= 1ull << (key & 63);
+}
+
+// Builds the source to action table from the bindings with a counting sort by source.
+static void input_action_compile() {
+    kzero_memory(state.source_offsets, sizeof(state.source_offsets));
+    for (u32 i = 0; i < state.binding_count; ++i) {
+        state.source_offsets[state.bindings[i].source + 1]++;
+    }
+    for (u32 s = 0; s < INPUT_ACTION_SOURCE_COUNT; ++s) {
+        state.source_offsets[s + 1] += state.source_offsets[s];
+    }
+
+    u16 cursors[INPUT_ACTION_SOURCE_COUNT];
+    kcopy_memory(cursors, state.source_offsets, sizeof(cursors));
+    for (u32 i = 0; i < state.binding_count; ++i) {
+        const input_binding* binding = &state.bindings[i];
+        u16 entry = cursors[binding->source]++;
+        state.compiled_actions[entry] = binding->action;
+        state.compiled_modifiers[entry] = binding->modifiers;
+    }
+    state.dirty = FALSE;
+}
+
+// Marks the actions driven by a source as down if the held modifiers match the binding.
+static inline void input_action_apply_source(u32 source, u8 held_modifiers) {
+    u8 source_modifier = source < INPUT_ACTION_KEY_SOURCES ? state.key_modifiers[source] : 0;
+    // A modifier key bound on its own is not held back by itself being down.
+    u8 modifiers = held_modifiers & ~source_modifier;
+    u32 end = state.source_offsets[source + 1];
+    for (u32 entry = state.source_offsets[source]; entry < end; ++entry) {
+        u8 required = state.compiled_modifiers[entry];
+        if ((required & INPUT_MODIFIER_ANY) || required == modifiers) {
+            state.states[state.compiled_actions[entry]] |= INPUT_ACTION_DOWN;
+        }
+    }
+}
+
+static b8 input_action_bind(u16 action, u32 source, u8 modifiers) {
+    if (!state.is_initialized) {
+        return FALSE;
+    }
+    if (action >= MAX_INPUT_ACTIONS) {
+        KWARN("Input action %u is out of range", action);
+        return FALSE;
+    }
+    if (state.binding_count == MAX_INPUT_BINDINGS) {
+        KERROR("Input action system ran out of bindings");
+        return FALSE;
+    }
+
+    input_binding* binding = &state.bindings[state.binding_count++];
+    binding->source = (u16)source;
+    binding->action = action;
+    binding->modifiers = modifiers;
+    if (action >= state.action_count) {
+        state.action_count = action + 1;
+    }
+    state.dirty = TRUE;
+    return TRUE;
+}
+
+b8 input_action_initialize() {
+    if (state.is_initialized) {
+        KWARN("Input action system already initialized!");
+        return FALSE;
+    }
+    kzero_memory(&state, sizeof(state));
+
+    // 0x10-0x12 are the side-agnostic codes Windows sends for shift, control and alt.
+    input_action_add_modifier_key(KEY_SHIFT, 0);
+    input_action_add_modifier_key(KEY_LSHIFT, 0);
+    input_action_add_modifier_key(KEY_RSHIFT, 0);
+    input_action_add_modifier_key(KEY_CONTROL, 1);
+    input_action_add_modifier_key(KEY_LCONTROL, 1);
+    input_action_add_modifier_key(KEY_RCONTROL, 1);
+    input_action_add_modifier_key(0x12, 2);
+    input_action_add_modifier_key(KEY_LMENU, 2);
+    input_action_add_modifier_key(KEY_RMENU, 2);
+
+    state.is_initialized = TRUE;
+    KDEBUG("Input action system initialized");
+    return TRUE;
+}
+
+void input_action_shutdown() {
+    state.is_initialized = FALSE;
+}
+
+void input_action_update() {
+    if (!state.is_initialized) {
+        return;
+    }
+    if (state.dirty) {
+        input_action_compile();
+    }
+
+    // Keep last frame's down bit aside and clear the rest. Both passes over the states
+    // work on eight actions per 64-bit word; no lane ever carries into the next.
+    u64* state_words = (u64*)state.states;
+    u32 word_count = (state.action_count + 7) / 8;
+    for (u32 w = 0; w < word_count; ++w) {
+        state_words[w] = (state_words[w] & INPUT_ACTION_LANES_DOWN) << 4;
+    }
+
+    key_bitset down;
+    input_get_keys_down(&down);
+    u8 held_modifiers = 0;
+    for (u32 m = 0; m < 3; ++m) {
+        u64 held = 0;
+        for (u32 w = 0; w < KEY_BITSET_WORDS; ++w) {
+            held |= down.words[w] & state.modifier_keys[m].words[w];
+        }
+        held_modifiers |= held ? (u8)(1 << m) : 0;
+    }
+
+    // Only the keys and buttons that are down can drive an action.
+    for (u32 key = key_bitset_next(&down, 0); key < INPUT_ACTION_KEY_SOURCES; key = key_bitset_next(&down, key + 1)) {
+        input_action_apply_source(key, held_modifiers);
+    }
+    for (u32 button_bits = input_get_buttons_down(); button_bits; button_bits &= button_bits - 1) {
+        input_action_apply_source(INPUT_ACTION_KEY_SOURCES + __builtin_ctz(button_bits), held_modifiers);
+    }
+
+    // Derive the edges from the old and new down bits.
+    for (u32 w = 0; w < word_count; ++w) {
+        u64 is_down = state_words[w] & INPUT_ACTION_LANES_DOWN;
+        u64 was_down = (state_words[w] >> 4) & INPUT_ACTION_LANES_DOWN;
+        state_words[w] = is_down | ((is_down & ~was_down) << 1) | ((was_down & ~is_down) << 2);
+    }
+}
+
+b8 input_action_bind_key(u16 action, keys key, u8 modifiers) {
+    if ((u32)key >= INPUT_ACTION_KEY_SOURCES) {
+        return FALSE;
+    }
+    return input_action_bind(action, (u32)key, modifiers);
+}
+
+b8 input_action_bind_button(u16 action, buttons button, u8 modifiers) {
+    if ((u32)button >= BUTTON_MAX_BUTTONS) {
+        return FALSE;
+    }
+    return input_action_bind(action, INPUT_ACTION_KEY_SOURCES + (u32)button, modifiers);
+}
+
+void input_action_unbind(u16 action) {
+    // Swap-remove every binding of the action; order does not matter before compiling.
+    for (u32 i = 0; i < state.binding_count;) {
+        if (state.bindings[i].action == action) {
+            state.bindings[i] = state.bindings[--state.binding_count];
+            state.dirty = TRUE;
+        } else {
+            ++i;
+        }
+    }
+}
+
+void input_action_clear_bindings() {
+    state.binding_count = 0;
+    state.dirty = TRUE;
+}
+
+u8 input_action_get_state(u16 action) {
+    return action < MAX_INPUT_ACTIONS ? state.states[action] : 0;
+}
+
+const u8* input_action_get_states() {
+    return state.states;
+}
+
+b8 input_action_down(u16 action) {
+    return (input_action_get_state(action) & INPUT_ACTION_DOWN) != 0;
+}
+
+b8 input_action_pressed(u16 action) {
+    return (input_action_get_state(action) & INPUT_ACTION_PRESSED) != 0;
+}
+
+b8 input_action_released(u16 action) {
+    return (input_action_get_state(action) & INPUT_ACTION_RELEASED) != 0;
+}
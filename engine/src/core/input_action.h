@@ -0,0 +1,82 @@
+#pragma once
+
+#include "defines.h"
+#include "core/input.h"
+
+/**
+ * Action mapping on top of the input system. Game code binds keys and mouse buttons,
+ * optionally combined with modifiers, to numbered actions and then queries the actions
+ * instead of raw keys. Any number of bindings can map to one action, and one key can
+ * drive several actions.
+ *
+ * Bindings are compiled into a flat table from each key and button to the actions it
+ * drives. Once per frame the states of all actions are rebuilt in bulk from the keys and
+ * buttons that are down, so a query is a single array load.
+ */
+
+// Actions are numbered from 0 up to this limit.
+#define MAX_INPUT_ACTIONS 1024
+
+typedef enum input_modifier {
+    INPUT_MODIFIER_NONE = 0x00,
+    INPUT_MODIFIER_SHIFT = 0x01,
+    INPUT_MODIFIER_CONTROL = 0x02,
+    INPUT_MODIFIER_ALT = 0x04,
+    // The binding triggers whatever modifiers are held.
+    INPUT_MODIFIER_ANY = 0x80
+} input_modifier;
+
+// Bits of an action's state.
+typedef enum input_action_state_flag {
+    // The action is held.
+    INPUT_ACTION_DOWN = 0x01,
+    // The action went down this frame.
+    INPUT_ACTION_PRESSED = 0x02,
+    // The action went up this frame.
+    INPUT_ACTION_RELEASED = 0x04
+} input_action_state_flag;
+
+b8 input_action_initialize();
+void input_action_shutdown();
+
+/**
+ * Recompiles the bindings if they changed and rebuilds every action state from the
+ * current input state. Called once per frame by the application, after the platform
+ * messages have been pumped.
+ */
+void input_action_update();
+
+/**
+ * Binds a key to an action. A binding with modifiers only triggers when exactly those
+ * modifiers are held, so Ctrl+S and S can drive different actions; use
+ * INPUT_MODIFIER_ANY for bindings that should ignore modifiers, such as movement.
+ * Takes effect from the next input_action_update.
+ * @param action The action to bind, below MAX_INPUT_ACTIONS.
+ * @param key The key that triggers the action.
+ * @param modifiers A combination of input_modifier flags.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 input_action_bind_key(u16 action, keys key, u8 modifiers);
+
+// Binds a mouse button to an action. See input_action_bind_key.
+KAPI b8 input_action_bind_button(u16 action, buttons button, u8 modifiers);
+
+// Removes every binding of the action.
+KAPI void input_action_unbind(u16 action);
+
+// Removes every binding of every action.
+KAPI void input_action_clear_bindings();
+
+// The input_action_state_flag bits of the action for this frame.
+KAPI u8 input_action_get_state(u16 action);
+
+/**
+ * Returns the state array of all actions, indexed by action, for code that queries many
+ * actions per frame without calling across the library boundary. The array stays valid
+ * until shutdown and is updated in place every frame.
+ */
+KAPI const u8* input_action_get_states();
+
+KAPI b8 input_action_down(u16 action);
+KAPI b8 input_action_pressed(u16 action);
+KAPI b8 input_action_released(u16 action);
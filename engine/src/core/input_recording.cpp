@@ -0,0 +1,255 @@
+#include "core/input_recording.h"
+#include "core/logger.h"
+#include "core/kmemory.h"
+
+#include <stdio.h>
+
+// "KINR" in a little-endian file.
+#define INPUT_RECORDING_MAGIC 0x524E494Bu
+#define INPUT_RECORDING_VERSION 2
+
+/**
+ * File layout: an input_recording_header followed by record_count input_records in the
+ * order they happened. Everything is stored in the machine's byte order.
+ */
+typedef struct input_recording_header {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u32 record_count;
+    // Frames recorded, including trailing frames without input. Every record's frame is
+    // below it.
+    u32 frame_count;
+} input_recording_header;
+
+typedef struct input_record {
+    // Frame the event happened in, counted from the start of the recording.
+    u32 frame;
+    u8 type;
+    b8 pressed;
+    u16 code;
+    i16 x;
+    i16 y;
+} input_record;
+
+STATIC_ASSERT(sizeof(input_record) == 12, "Expected input_record to be 12 bytes.");
+
+typedef struct input_recording_state {
+    // Recording
+    FILE* file;
+    u32 recorded_count;
+    u32 record_frame;
+
+    // Playback
+    input_record* records;
+    u32 record_count;
+    u32 frame_count;
+    u32 next_record;
+    u32 playback_frame;
+    b8 playing;
+    b8 finished;
+    // Set while feeding recorded events, so they pass the platform input block.
+    b8 injecting;
+} input_recording_state;
+
+static input_recording_state state;
+
+// Whether a record loaded from a file is something playback can safely feed to input.
+static b8 input_record_is_valid(const input_record* record) {
+    switch (record->type) {
+        case INPUT_EVENT_KEY:
+            return record->code < KEY_BITSET_WORDS * 64;
+        case INPUT_EVENT_BUTTON:
+            return record->code < BUTTON_MAX_BUTTONS;
+        case INPUT_EVENT_MOUSE_MOVE:
+        case INPUT_EVENT_MOUSE_WHEEL:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+b8 input_recording_start(const char* path) {
+    if (state.playing) {
+        KWARN("Cannot record input during a playback");
+        return FALSE;
+    }
+    input_recording_stop();
+
+    state.file = fopen(path, "wb");
+    if (!state.file) {
+        KERROR("Failed to open '%s' to record input", path);
+        return FALSE;
+    }
+    // Reserve the header; the counts are filled in when the recording stops.
+    input_recording_header header = {};
+    fwrite(&header, sizeof(header), 1, state.file);
+    state.recorded_count = 0;
+    state.record_frame = 0;
+    KINFO("Recording input to '%s'", path);
+    return TRUE;
+}
+
+void input_recording_stop() {
+    if (!state.file) {
+        return;
+    }
+    input_recording_header header;
+    header.magic = INPUT_RECORDING_MAGIC;
+    header.version = INPUT_RECORDING_VERSION;
+    header.record_size = sizeof(input_record);
+    header.record_count = state.recorded_count;
+    // Events captured since the last frame began belong to frame record_frame too.
+    header.frame_count = state.record_frame + 1;
+    fseek(state.file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, state.file);
+    fclose(state.file);
+    state.file = 0;
+    KINFO("Recorded %u input events over %u frames", header.record_count, header.frame_count);
+}
+
+b8 input_playback_start(const char* path) {
+    if (state.file) {
+        KWARN("Cannot play input back while recording");
+        return FALSE;
+    }
+    input_playback_stop();
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        KERROR("Failed to open input recording '%s'", path);
+        return FALSE;
+    }
+    input_recording_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != INPUT_RECORDING_MAGIC ||
+        header.version != INPUT_RECORDING_VERSION || header.record_size != sizeof(input_record)) {
+        KERROR("'%s' is not an input recording this build can play", path);
+        fclose(file);
+        return FALSE;
+    }
+
+    // Load the whole recording up front so playing it back does no I/O.
+    input_record* records = 0;
+    if (header.record_count) {
+        records = (input_record*)kallocate(sizeof(input_record) * header.record_count, MEMORY_TAG_INPUT);
+        if (fread(records, sizeof(input_record), header.record_count, file) != header.record_count) {
+            KERROR("Input recording '%s' is truncated", path);
+            kfree(records, sizeof(input_record) * header.record_count, MEMORY_TAG_INPUT);
+            fclose(file);
+            return FALSE;
+        }
+        // Reject bad files here, so playback never indexes input state with a bad code.
+        // Playback also relies on records being in frame order and inside the recording;
+        // a record out of order would never be reached and the playback would never end.
+        for (u32 i = 0; i < header.record_count; ++i) {
+            if (!input_record_is_valid(&records[i])) {
+                KERROR("Input recording '%s' has an invalid record %u (type %u, code %u)", path, i,
+                       records[i].type, records[i].code);
+                kfree(records, sizeof(input_record) * header.record_count, MEMORY_TAG_INPUT);
+                fclose(file);
+                return FALSE;
+            }
+            if (records[i].frame >= header.frame_count || (i > 0 && records[i].frame < records[i - 1].frame)) {
+                KERROR("Input recording '%s' has record %u out of frame order (frame %u of %u)", path, i,
+                       records[i].frame, header.frame_count);
+                kfree(records, sizeof(input_record) * header.record_count, MEMORY_TAG_INPUT);
+                fclose(file);
+                return FALSE;
+            }
+        }
+    }
+    fclose(file);
+
+    state.records = records;
+    state.record_count = header.record_count;
+    state.frame_count = header.frame_count;
+    state.next_record = 0;
+    state.playback_frame = 0;
+    state.playing = TRUE;
+    state.finished = FALSE;
+    KINFO("Playing back %u input events over %u frames from '%s'", header.record_count, header.frame_count, path);
+    return TRUE;
+}
+
+void input_playback_stop() {
+    if (state.records) {
+        kfree(state.records, sizeof(input_record) * state.record_count, MEMORY_TAG_INPUT);
+        state.records = 0;
+    }
+    state.record_count = 0;
+    state.playing = FALSE;
+}
+
+b8 input_recording_is_active() {
+    return state.file != 0;
+}
+
+b8 input_playback_is_active() {
+    return state.playing;
+}
+
+b8 input_playback_is_finished() {
+    return state.finished;
+}
+
+void input_recording_begin_frame() {
+    if (state.file) {
+        // Events captured from here on belong to the next frame.
+        state.record_frame++;
+    }
+    if (!state.playing) {
+        return;
+    }
+
+    state.injecting = TRUE;
+    while (state.next_record < state.record_count && state.records[state.next_record].frame == state.playback_frame) {
+        const input_record* record = &state.records[state.next_record++];
+        switch (record->type) {
+            case INPUT_EVENT_KEY:
+                input_process_key((keys)record->code, record->pressed);
+                break;
+            case INPUT_EVENT_BUTTON:
+                input_process_button((buttons)record->code, record->pressed);
+                break;
+            case INPUT_EVENT_MOUSE_MOVE:
+                input_process_mouse_move(record->x, record->y);
+                break;
+            case INPUT_EVENT_MOUSE_WHEEL:
+                input_process_mouse_wheel((i8)record->x);
+                break;
+        }
+    }
+    state.injecting = FALSE;
+
+    state.playback_frame++;
+    if (state.playback_frame >= state.frame_count && state.next_record >= state.record_count) {
+        KINFO("Input playback finished after %u frames", state.playback_frame);
+        input_playback_stop();
+        state.finished = TRUE;
+    }
+}
+
+void input_recording_shutdown() {
+    input_recording_stop();
+    input_playback_stop();
+    state.finished = FALSE;
+}
+
+void input_recording_capture(const input_event* event) {
+    if (!state.file) {
+        return;
+    }
+    input_record record;
+    record.frame = state.record_frame;
+    record.type = event->type;
+    record.pressed = event->pressed;
+    record.code = event->code;
+    record.x = event->x;
+    record.y = event->y;
+    fwrite(&record, sizeof(record), 1, state.file);
+    state.recorded_count++;
+}
+
+b8 input_playback_blocks_platform() {
+    return state.playing && !state.injecting;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "defines.h"
+#include "core/input.h"
+
+/**
+ * Records everything that passes through the input_process_* functions into a compact
+ * binary file, tagged with the frame it happened in, and plays such files back into the
+ * input system frame by frame. While playing back, input from the platform is ignored,
+ * so a recorded session drives the same workload every run, with or without a window.
+ */
+
+/**
+ * Starts recording input to the given file, replacing it. Frames are counted from the
+ * next call to input_recording_begin_frame.
+ * @returns TRUE on success; FALSE if the file could not be opened or playback is running.
+ */
+KAPI b8 input_recording_start(const char* path);
+
+// Stops recording and closes the file.
+KAPI void input_recording_stop();
+
+/**
+ * Starts playing back a file written by input_recording_start. The first recorded frame
+ * is played at the next call to input_recording_begin_frame.
+ * @returns TRUE on success; FALSE if the file could not be read or is not a recording.
+ */
+KAPI b8 input_playback_start(const char* path);
+
+// Stops playing back; platform input is accepted again.
+KAPI void input_playback_stop();
+
+KAPI b8 input_recording_is_active();
+KAPI b8 input_playback_is_active();
+
+// TRUE once a playback has played its last frame, until the next playback starts.
+KAPI b8 input_playback_is_finished();
+
+/**
+ * Advances to the next frame. During playback, feeds the events recorded for this frame
+ * into the input system. Called once per frame by the application, after the platform
+ * messages have been pumped.
+ */
+void input_recording_begin_frame();
+
+void input_recording_shutdown();
+
+// Called by the input system for each input event it records.
+void input_recording_capture(const input_event* event);
+
+// TRUE while platform input must be dropped because a playback is feeding the input system.
+b8 input_playback_blocks_platform();
@@ -0,0 +1,226 @@
+#include "core/kmemory.h"
+#include "core/logger.h"
+#include "platform/platform.h"
+#include "memory/tlsf_allocator.h"
+
+// TODO: Custom string lib
+#include <stdio.h>
+
+typedef struct memory_stats {
+    u64 total_allocated;
+    u64 tagged_allocations[MEMORY_TAG_MAX_TAGS];
+    u64 tagged_counts[MEMORY_TAG_MAX_TAGS];
+    u64 tagged_peaks[MEMORY_TAG_MAX_TAGS];
+    u64 tagged_budgets[MEMORY_TAG_MAX_TAGS];
+} memory_stats;
+
+static const char* memory_tag_strings[MEMORY_TAG_MAX_TAGS] = {
+    "UNKNOWN    ",
+    "ARRAY      ",
+    "DARRAY     ",
+    "DICT       ",
+    "RING_QUEUE ",
+    "BST        ",
+    "STRING     ",
+    "APPLICATION",
+    "JOB        ",
+    "TEXTURE    ",
+    "MAT_INST   ",
+    "RENDERER   ",
+    "GAME       ",
+    "TRANSFORM  ",
+    "ENTITY     ",
+    "ENTITY_NODE",
+    "SCENE      ",
+    "EVENT      ",
+    "INPUT      ",
+    "LOGGER     ",
+    "PLATFORM   ",
+    "LINEAR_ALLC"};
+
+typedef struct memory_system_state {
+    memory_system_config config;
+    memory_stats stats;
+    // The engine heap. Only valid while heap_active is set.
+    tlsf_allocator heap;
+    b8 heap_active;
+} memory_system_state;
+
+/**
+ * Memory system internal state. Kept zero-initialized at load time rather than in
+ * initialize_memory(), since the game instance may allocate before the application
+ * brings the subsystems up.
+ */
+static memory_system_state state;
+
+b8 initialize_memory(memory_system_config config) {
+    state.config = config;
+    if (config.use_system_allocator) {
+        KDEBUG("Memory subsystem initialized, using the system allocator.");
+        return TRUE;
+    }
+
+    // The heap is one large block, so back it with whole pages (huge ones if requested)
+    // straight from the OS.
+    void* heap_memory = platform_allocate_pages(config.total_alloc_size, config.use_huge_pages);
+    if (!heap_memory || !tlsf_allocator_create(config.total_alloc_size, heap_memory, &state.heap)) {
+        KERROR("Memory subsystem failed to reserve the engine heap.");
+        if (heap_memory) {
+            platform_free_pages(heap_memory, config.total_alloc_size, config.use_huge_pages);
+        }
+        return FALSE;
+    }
+    state.heap_active = TRUE;
+    KDEBUG("Memory subsystem initialized with a %llu byte heap%s.", config.total_alloc_size,
+           config.use_huge_pages ? " on huge pages" : "");
+    return TRUE;
+}
+
+void shutdown_memory() {
+    memory_log_usage();
+    if (state.heap_active) {
+        state.heap_active = FALSE;
+        void* heap_memory = state.heap.memory;
+        tlsf_allocator_destroy(&state.heap);
+        platform_free_pages(heap_memory, state.config.total_alloc_size, state.config.use_huge_pages);
+    }
+}
+
+// Alignment the system allocator already guarantees for every block.
+#define SYSTEM_ALLOCATOR_ALIGNMENT 16
+
+void* kallocate(u64 size, memory_tag tag) {
+    return kallocate_aligned(size, 1, tag);
+}
+
+void* kallocate_aligned(u64 size, u16 alignment, memory_tag tag) {
+    if (tag == MEMORY_TAG_UNKNOWN) {
+        KWARN("kallocate called using MEMORY_TAG_UNKNOWN. Re-class this allocation.");
+    }
+
+    void* block = 0;
+    if (state.heap_active) {
+        block = tlsf_allocator_allocate_aligned(&state.heap, size, alignment);
+        if (!block) {
+            KWARN("kallocate - engine heap exhausted, falling back to the system allocator for %llu bytes.", size);
+        }
+    }
+    if (!block) {
+        if (alignment > SYSTEM_ALLOCATOR_ALIGNMENT) {
+            block = platform_allocate_aligned(size, alignment);
+        } else {
+            block = platform_allocate(size, FALSE);
+        }
+    }
+    if (!block) {
+        KERROR("kallocate - out of memory allocating %llu bytes for %s.", size, memory_tag_strings[tag]);
+        return 0;
+    }
+    platform_zero_memory(block, size);
+
+    // Only blocks actually handed out are accounted.
+    state.stats.total_allocated += size;
+    state.stats.tagged_allocations[tag] += size;
+    state.stats.tagged_counts[tag]++;
+    if (state.stats.tagged_allocations[tag] > state.stats.tagged_peaks[tag]) {
+        state.stats.tagged_peaks[tag] = state.stats.tagged_allocations[tag];
+    }
+    if (state.stats.tagged_budgets[tag] && state.stats.tagged_allocations[tag] > state.stats.tagged_budgets[tag]) {
+        KWARN("Memory tag %s is over budget: %llu / %llu bytes.",
+              memory_tag_strings[tag], state.stats.tagged_allocations[tag], state.stats.tagged_budgets[tag]);
+    }
+    return block;
+}
+
+void kfree(void* block, u64 size, memory_tag tag) {
+    kfree_aligned(block, size, 1, tag);
+}
+
+void kfree_aligned(void* block, u64 size, u16 alignment, memory_tag tag) {
+    if (tag == MEMORY_TAG_UNKNOWN) {
+        KWARN("kfree called using MEMORY_TAG_UNKNOWN. Re-class this allocation.");
+    }
+    if (!block) {
+        return;
+    }
+
+    state.stats.total_allocated -= size;
+    state.stats.tagged_allocations[tag] -= size;
+    state.stats.tagged_counts[tag]--;
+
+    // Blocks made before the heap existed, or after it ran out, belong to the system.
+    if (state.heap_active && tlsf_allocator_owns(&state.heap, block)) {
+        tlsf_allocator_free(&state.heap, block);
+    } else {
+        platform_free(block, alignment > SYSTEM_ALLOCATOR_ALIGNMENT);
+    }
+}
+
+void* kzero_memory(void* block, u64 size) {
+    return platform_zero_memory(block, size);
+}
+
+void* kcopy_memory(void* dest, const void* source, u64 size) {
+    return platform_copy_memory(dest, source, size);
+}
+
+void* kset_memory(void* dest, i32 value, u64 size) {
+    return platform_set_memory(dest, value, size);
+}
+
+void memory_set_tag_budget(memory_tag tag, u64 budget) {
+    state.stats.tagged_budgets[tag] = budget;
+}
+
+// Formats the given amount of bytes into the most readable unit.
+static f32 memory_amount(u64 bytes, const char** unit) {
+    const u64 gib = 1024 * 1024 * 1024;
+    const u64 mib = 1024 * 1024;
+    const u64 kib = 1024;
+
+    if (bytes >= gib) {
+        *unit = "GiB";
+        return bytes / (f32)gib;
+    } else if (bytes >= mib) {
+        *unit = "MiB";
+        return bytes / (f32)mib;
+    } else if (bytes >= kib) {
+        *unit = "KiB";
+        return bytes / (f32)kib;
+    }
+    *unit = "B";
+    return (f32)bytes;
+}
+
+u64 get_memory_usage_str(char* buffer, u64 buffer_size) {
+    if (!buffer || buffer_size == 0) {
+        return 0;
+    }
+
+    u64 offset = snprintf(buffer, buffer_size, "System memory use (tagged):\n");
+    if (state.heap_active && offset < buffer_size) {
+        const char* unit;
+        f32 free_space = memory_amount(tlsf_allocator_free_space(&state.heap), &unit);
+        const char* total_unit;
+        f32 total = memory_amount(state.heap.total_size, &total_unit);
+        offset += snprintf(buffer + offset, buffer_size - offset, "  Engine heap: %.2f%s free of %.2f%s\n",
+                           free_space, unit, total, total_unit);
+    }
+    for (u32 i = 0; i < MEMORY_TAG_MAX_TAGS && offset < buffer_size; ++i) {
+        const char* unit;
+        f32 amount = memory_amount(state.stats.tagged_allocations[i], &unit);
+        const char* peak_unit;
+        f32 peak = memory_amount(state.stats.tagged_peaks[i], &peak_unit);
+
+        offset += snprintf(buffer + offset, buffer_size - offset, "  %s: %.2f%s in %llu allocations (peak %.2f%s)\n",
+                           memory_tag_strings[i], amount, unit, state.stats.tagged_counts[i], peak, peak_unit);
+    }
+
+    return offset < buffer_size ? offset : buffer_size - 1;
+}
+
+void memory_log_usage() {
+    char buffer[4000];
+    get_memory_usage_str(buffer, sizeof(buffer));
+    KINFO("%s", buffer);
+}
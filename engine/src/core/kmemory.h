@@ -0,0 +1,96 @@
+#pragma once
+
+#include "defines.h"
+
+typedef enum memory_tag {
+    // For temporary use. Should be assigned one of the below or have a new tag created.
+    MEMORY_TAG_UNKNOWN,
+    MEMORY_TAG_ARRAY,
+    MEMORY_TAG_DARRAY,
+    MEMORY_TAG_DICT,
+    MEMORY_TAG_RING_QUEUE,
+    MEMORY_TAG_BST,
+    MEMORY_TAG_STRING,
+    MEMORY_TAG_APPLICATION,
+    MEMORY_TAG_JOB,
+    MEMORY_TAG_TEXTURE,
+    MEMORY_TAG_MATERIAL_INSTANCE,
+    MEMORY_TAG_RENDERER,
+    MEMORY_TAG_GAME,
+    MEMORY_TAG_TRANSFORM,
+    MEMORY_TAG_ENTITY,
+    MEMORY_TAG_ENTITY_NODE,
+    MEMORY_TAG_SCENE,
+    MEMORY_TAG_EVENT,
+    MEMORY_TAG_INPUT,
+    MEMORY_TAG_LOGGER,
+    MEMORY_TAG_PLATFORM,
+    MEMORY_TAG_LINEAR_ALLOCATOR,
+
+    MEMORY_TAG_MAX_TAGS
+} memory_tag;
+
+typedef struct memory_system_config {
+    // Size in bytes of the engine heap reserved up front.
+    u64 total_alloc_size;
+
+    // Bypass the engine heap and allocate every block straight from the system. Useful
+    // for debugging with external memory tools.
+    b8 use_system_allocator;
+
+    // Back the engine heap with huge pages to cut TLB misses, where the OS supports it.
+    b8 use_huge_pages;
+} memory_system_config;
+
+b8 initialize_memory(memory_system_config config);
+void shutdown_memory();
+
+/**
+ * Allocates a zeroed block of memory of the given size and accounts it against the given
+ * tag. Blocks come from the engine heap once the memory system is initialized, and from
+ * the system allocator before that or when the heap is exhausted.
+ * The heap and the statistics are not synchronized: kallocate, kfree and their aligned
+ * versions must only be called from the main thread. Other threads must allocate up front
+ * or through the platform layer.
+ * @param size The size of the block in bytes.
+ * @param tag The tag the allocation is accounted against.
+ * @returns A pointer to the allocated block, or 0 if no memory is left.
+ */
+KAPI void* kallocate(u64 size, memory_tag tag);
+
+/**
+ * Allocates a zeroed block of memory aligned to the given power of 2 alignment, for
+ * example 64 to isolate data on its own cache line. Free it with kfree_aligned.
+ */
+KAPI void* kallocate_aligned(u64 size, u16 alignment, memory_tag tag);
+
+/**
+ * Frees a block previously obtained from kallocate. The size and tag must match
+ * the ones used for the allocation.
+ */
+KAPI void kfree(void* block, u64 size, memory_tag tag);
+
+// Frees a block previously obtained from kallocate_aligned, with the same size, alignment and tag.
+KAPI void kfree_aligned(void* block, u64 size, u16 alignment, memory_tag tag);
+
+KAPI void* kzero_memory(void* block, u64 size);
+
+KAPI void* kcopy_memory(void* dest, const void* source, u64 size);
+
+KAPI void* kset_memory(void* dest, i32 value, u64 size);
+
+/**
+ * Sets a soft budget for the given tag. Once the live bytes of the tag go above it,
+ * a warning is logged. A budget of 0 disables the check.
+ */
+KAPI void memory_set_tag_budget(memory_tag tag, u64 budget);
+
+/**
+ * Writes a human readable usage report (live bytes and allocation count per tag) into
+ * the provided buffer.
+ * @returns The number of characters written, not counting the terminator.
+ */
+KAPI u64 get_memory_usage_str(char* buffer, u64 buffer_size);
+
+// Logs the current memory usage report.
+KAPI void memory_log_usage();
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "core/event.h"
+
+#include <string.h>
+#include <type_traits>
+
+/**
+ * Compile-time typed layer over the event system. An event type is a small trivially
+ * copyable struct that carries its event code as a static constant and lays its fields
+ * out the way listeners of the untyped API read event_context:
+ *
+ *     b8 Player::on_key(const key_pressed_event& e);
+ *     event_register<&Player::on_key>(&player);
+ *     event_fire(key_pressed_event{KEY_SPACE});
+ *
+ * Registration generates one callback per handler at compile time, so the handler call
+ * can be inlined into it and no code or layout is looked up at runtime. Everything still
+ * goes through the untyped functions in event.h, so typed and untyped listeners of the
+ * same code see each other's events.
+ */
+
+typedef struct application_quit_event {
+    static constexpr u16 code = EVENT_CODE_APPLICATION_QUIT;
+} application_quit_event;
+
+typedef struct key_pressed_event {
+    static constexpr u16 code = EVENT_CODE_KEY_PRESSED;
+    u16 key_code;
+} key_pressed_event;
+
+typedef struct key_released_event {
+    static constexpr u16 code = EVENT_CODE_KEY_RELEASED;
+    u16 key_code;
+} key_released_event;
+
+typedef struct button_pressed_event {
+    static constexpr u16 code = EVENT_CODE_BUTTON_PRESSED;
+    u16 button;
+} button_pressed_event;
+
+typedef struct button_released_event {
+    static constexpr u16 code = EVENT_CODE_BUTTON_RELEASED;
+    u16 button;
+} button_released_event;
+
+typedef struct mouse_moved_event {
+    static constexpr u16 code = EVENT_CODE_MOUSE_MOVED;
+    u16 x;
+    u16 y;
+} mouse_moved_event;
+
+typedef struct mouse_wheel_event {
+    static constexpr u16 code = EVENT_CODE_MOUSE_WHEEL;
+    i8 z_delta;
+} mouse_wheel_event;
+
+typedef struct resized_event {
+    static constexpr u16 code = EVENT_CODE_RESIZED;
+    u16 width;
+    u16 height;
+} resized_event;
+
+// Copies a typed payload into the untyped event context.
+template <typename E>
+inline event_context event_pack(const E& payload) {
+    static_assert(std::is_trivially_copyable<E>::value, "Event payloads must be trivially copyable.");
+    static_assert(sizeof(E) <= sizeof(event_context), "Event payloads must fit in an event_context.");
+    event_context context;
+    memset(&context, 0, sizeof(context));
+    memcpy(&context, &payload, sizeof(E));
+    return context;
+}
+
+// Reads a typed payload back out of an untyped event context.
+template <typename E>
+inline E event_unpack(const event_context& context) {
+    static_assert(std::is_trivially_copyable<E>::value, "Event payloads must be trivially copyable.");
+    static_assert(sizeof(E) <= sizeof(event_context), "Event payloads must fit in an event_context.");
+    E payload;
+    memcpy(&payload, &context, sizeof(E));
+    return payload;
+}
+
+// Fires a typed event immediately. See event_fire.
+template <typename E>
+inline b8 event_fire(const E& payload, void* sender = 0) {
+    return event_fire(E::code, sender, event_pack(payload));
+}
+
+// Queues a typed event for the next dispatch. See event_post.
+template <typename E>
+inline b8 event_post(const E& payload, void* sender = 0) {
+    return event_post(E::code, sender, event_pack(payload));
+}
+
+// Deduces the listener and event types of a handler.
+template <typename H>
+struct event_handler_traits;
+
+template <typename T, typename E>
+struct event_handler_traits<b8 (T::*)(const E&)> {
+    typedef T listener_type;
+    typedef E event_type;
+};
+
+template <typename T, typename E>
+struct event_handler_traits<b8 (T::*)(const E&) const> {
+    typedef const T listener_type;
+    typedef E event_type;
+};
+
+template <typename E>
+struct event_handler_traits<b8 (*)(const E&)> {
+    typedef void listener_type;
+    typedef E event_type;
+};
+
+/**
+ * The untyped callback generated for each typed handler. Typed listeners are stored and
+ * fired through the same PFN_on_event registry as untyped ones, which passes the payload
+ * as an event_context by value, so the thunk still copies it back out into an E. The copy
+ * is at most 16 bytes and stays in registers; removing it would need a second, typed
+ * registry next to the untyped one.
+ */
+template <auto Handler>
+b8 event_handler_thunk(u16 code, void* sender, void* listener_inst, event_context context) {
+    typedef event_handler_traits<decltype(Handler)> traits;
+    typedef typename traits::event_type event_type;
+    if constexpr (std::is_void<typename traits::listener_type>::value) {
+        return Handler(event_unpack<event_type>(context));
+    } else {
+        typedef typename traits::listener_type listener_type;
+        return (static_cast<listener_type*>(listener_inst)->*Handler)(event_unpack<event_type>(context));
+    }
+}
+
+/**
+ * Registers a typed handler: a member function b8 T::handler(const E&) called on the
+ * given listener, or a free function b8 handler(const E&) with no listener. The event
+ * code is taken from E.
+ * @returns A handle for event_unregister; EVENT_HANDLE_INVALID on failure.
+ */
+template <auto Handler>
+inline event_handle event_register(typename event_handler_traits<decltype(Handler)>::listener_type* listener = 0) {
+    typedef event_handler_traits<decltype(Handler)> traits;
+    return event_register(traits::event_type::code, (void*)listener, &event_handler_thunk<Handler>);
+}
+
+// Unregisters a handler registered with the typed event_register.
+template <auto Handler>
+inline b8 event_unregister(typename event_handler_traits<decltype(Handler)>::listener_type* listener = 0) {
+    typedef event_handler_traits<decltype(Handler)> traits;
+    return event_unregister(traits::event_type::code, (void*)listener, &event_handler_thunk<Handler>);
+}
@@ -98,3 +98,9 @@ STATIC_ASSERT(sizeof(f64) == 8, "Expected f64 to be 8 bytes.");
 #endif
 #endif
 
+// Keeps rarely taken paths out of the function calling them.
+#ifdef _MSC_VER
+#define KNOINLINE __declspec(noinline)
+#else
+#define KNOINLINE __attribute__((noinline))
+#endif
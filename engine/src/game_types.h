@@ -24,6 +24,9 @@ public:
     // Function pointer to handle resizes, if applicable.
     void on_resize(struct Game* game_inst, u32 width, u32 height);
 
+    // Function pointer to game's shutdown function. Called before the engine's systems shut down.
+    void shutdown(struct Game* game_inst);
+
     // Game-specific game state. Created and managed by the game.
     void* state;
 };
@@ -0,0 +1,72 @@
+#include "memory/linear_allocator.h"
+
+#include "core/kmemory.h"
+#include "core/logger.h"
+
+// Alignment of every block handed out by the allocator.
+#define LINEAR_ALLOCATOR_ALIGNMENT 16
+
+b8 linear_allocator_create(u64 total_size, void* memory, linear_allocator* out_allocator) {
+    if (!out_allocator) {
+        KERROR("linear_allocator_create requires a valid pointer to out_allocator.");
+        return FALSE;
+    }
+
+    out_allocator->total_size = total_size;
+    out_allocator->allocated = 0;
+    out_allocator->high_water_mark = 0;
+    out_allocator->owns_memory = memory == 0;
+    if (memory) {
+        out_allocator->memory = memory;
+    } else {
+        out_allocator->memory = kallocate(total_size, MEMORY_TAG_LINEAR_ALLOCATOR);
+        if (!out_allocator->memory) {
+            KERROR("linear_allocator_create failed to allocate %llu bytes.", total_size);
+            out_allocator->total_size = 0;
+            out_allocator->owns_memory = FALSE;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void linear_allocator_destroy(linear_allocator* allocator) {
+    if (!allocator) {
+        return;
+    }
+
+    if (allocator->owns_memory && allocator->memory) {
+        kfree(allocator->memory, allocator->total_size, MEMORY_TAG_LINEAR_ALLOCATOR);
+    }
+    allocator->memory = 0;
+    allocator->total_size = 0;
+    allocator->allocated = 0;
+    allocator->owns_memory = FALSE;
+}
+
+void* linear_allocator_allocate(linear_allocator* allocator, u64 size) {
+    if (!allocator || !allocator->memory) {
+        KERROR("linear_allocator_allocate - allocator not initialized.");
+        return 0;
+    }
+
+    u64 offset = (allocator->allocated + (LINEAR_ALLOCATOR_ALIGNMENT - 1)) & ~(u64)(LINEAR_ALLOCATOR_ALIGNMENT - 1);
+    if (offset + size > allocator->total_size) {
+        u64 remaining = allocator->total_size - allocator->allocated;
+        KERROR("linear_allocator_allocate - Tried to allocate %lluB, only %lluB remaining.", size, remaining);
+        return 0;
+    }
+
+    void* block = ((u8*)allocator->memory) + offset;
+    allocator->allocated = offset + size;
+    if (allocator->allocated > allocator->high_water_mark) {
+        allocator->high_water_mark = allocator->allocated;
+    }
+    return block;
+}
+
+void linear_allocator_free_all(linear_allocator* allocator) {
+    if (allocator && allocator->memory) {
+        allocator->allocated = 0;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * A simple bump allocator. Allocations are carved linearly out of a single block and
+ * can only be released all at once with linear_allocator_free_all.
+ */
+typedef struct linear_allocator {
+    u64 total_size;
+    u64 allocated;
+    // The highest amount ever allocated between two resets. Use it to size the allocator.
+    u64 high_water_mark;
+    void* memory;
+    b8 owns_memory;
+} linear_allocator;
+
+/**
+ * Creates a linear allocator.
+ * @param total_size The total size in bytes the allocator can hand out.
+ * @param memory A block of at least total_size bytes to use, or 0 to have the allocator own its memory.
+ * @param out_allocator A pointer to hold the created allocator.
+ * @returns TRUE on success; FALSE if the allocator's memory could not be allocated.
+ */
+KAPI b8 linear_allocator_create(u64 total_size, void* memory, linear_allocator* out_allocator);
+KAPI void linear_allocator_destroy(linear_allocator* allocator);
+
+/**
+ * Allocates a 16-byte aligned block from the allocator.
+ * @returns A pointer to the block, or 0 if the allocator ran out of space.
+ */
+KAPI void* linear_allocator_allocate(linear_allocator* allocator, u64 size);
+
+// Releases every allocation at once. The memory is not zeroed.
+KAPI void linear_allocator_free_all(linear_allocator* allocator);
@@ -0,0 +1,375 @@
+#include "memory/tlsf_allocator.h"
+
+#include "core/logger.h"
+#include "platform/platform.h"
+
+/**
+ * Block header placed in front of every block. Blocks are laid out back to back, so the
+ * next physical block is found by skipping the payload, and the previous one is linked.
+ * The free list links only exist while the block is free and live in its payload.
+ */
+typedef struct tlsf_block {
+    struct tlsf_block* prev_phys;
+    // Payload size in bytes. The lowest bit flags the block as free.
+    u64 size;
+
+    // Only valid while the block is free.
+    struct tlsf_block* next_free;
+    struct tlsf_block* prev_free;
+} tlsf_block;
+
+#define TLSF_BLOCK_HEADER_SIZE 16
+#define TLSF_BLOCK_FREE_BIT 1ull
+// A free block must be able to hold its free list links.
+#define TLSF_BLOCK_SIZE_MIN 16
+
+STATIC_ASSERT(TLSF_BLOCK_HEADER_SIZE == sizeof(tlsf_block*) + sizeof(u64), "Unexpected TLSF block header size.");
+STATIC_ASSERT(TLSF_BLOCK_SIZE_MIN == sizeof(tlsf_block*) * 2, "Unexpected TLSF minimum block size.");
+
+static inline u64 block_size(const tlsf_block* block) {
+    return block->size & ~TLSF_BLOCK_FREE_BIT;
+}
+
+static inline void block_set_size(tlsf_block* block, u64 size) {
+    block->size = size | (block->size & TLSF_BLOCK_FREE_BIT);
+}
+
+static inline b8 block_is_free(const tlsf_block* block) {
+    return (block->size & TLSF_BLOCK_FREE_BIT) != 0;
+}
+
+static inline void block_set_free(tlsf_block* block, b8 free) {
+    block->size = free ? (block->size | TLSF_BLOCK_FREE_BIT) : (block->size & ~TLSF_BLOCK_FREE_BIT);
+}
+
+static inline void* block_to_ptr(tlsf_block* block) {
+    return (u8*)block + TLSF_BLOCK_HEADER_SIZE;
+}
+
+static inline tlsf_block* block_from_ptr(const void* ptr) {
+    return (tlsf_block*)((u8*)ptr - TLSF_BLOCK_HEADER_SIZE);
+}
+
+static inline tlsf_block* block_next(tlsf_block* block) {
+    return (tlsf_block*)((u8*)block_to_ptr(block) + block_size(block));
+}
+
+static inline u64 align_up(u64 value, u64 alignment) {
+    return (value + (alignment - 1)) & ~(alignment - 1);
+}
+
+// Index of the most significant set bit.
+static inline i32 tlsf_fls(u64 value) {
+    return 63 - __builtin_clzll(value);
+}
+
+// Index of the least significant set bit.
+static inline i32 tlsf_ffs(u32 value) {
+    return __builtin_ctz(value);
+}
+
+// Computes the size class of a block.
+static inline void mapping_insert(u64 size, i32* fl, i32* sl) {
+    if (size < TLSF_SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = (i32)(size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT));
+    } else {
+        i32 f = tlsf_fls(size);
+        *sl = (i32)(size >> (f - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+        *fl = f - (TLSF_FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Computes the size class to search for a request. The size is rounded up to the next
+// class so that any block found there is large enough without scanning the list.
+static inline void mapping_search(u64 size, i32* fl, i32* sl) {
+    if (size >= TLSF_SMALL_BLOCK_SIZE) {
+        size += (1ull << (tlsf_fls(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static tlsf_block* find_suitable_block(tlsf_allocator* allocator, i32* fl, i32* sl) {
+    if (*fl >= TLSF_FL_INDEX_COUNT) {
+        return 0;
+    }
+
+    // Search for a non-empty list in the same first level class.
+    u32 sl_map = allocator->sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        // None, so try the next larger first level class.
+        u32 fl_map = *fl + 1 < 32 ? allocator->fl_bitmap & (~0u << (*fl + 1)) : 0;
+        if (!fl_map) {
+            // Out of memory.
+            return 0;
+        }
+        *fl = tlsf_ffs(fl_map);
+        sl_map = allocator->sl_bitmap[*fl];
+    }
+    *sl = tlsf_ffs(sl_map);
+    return allocator->blocks[*fl][*sl];
+}
+
+static void remove_free_block(tlsf_allocator* allocator, tlsf_block* block, i32 fl, i32 sl) {
+    tlsf_block* prev = block->prev_free;
+    tlsf_block* next = block->next_free;
+    if (next) {
+        next->prev_free = prev;
+    }
+    if (prev) {
+        prev->next_free = next;
+    }
+
+    if (allocator->blocks[fl][sl] == block) {
+        allocator->blocks[fl][sl] = next;
+        if (!next) {
+            allocator->sl_bitmap[fl] &= ~(1u << sl);
+            if (!allocator->sl_bitmap[fl]) {
+                allocator->fl_bitmap &= ~(1u << fl);
+            }
+        }
+    }
+}
+
+static void insert_free_block(tlsf_allocator* allocator, tlsf_block* block, i32 fl, i32 sl) {
+    tlsf_block* current = allocator->blocks[fl][sl];
+    block->next_free = current;
+    block->prev_free = 0;
+    if (current) {
+        current->prev_free = block;
+    }
+
+    allocator->blocks[fl][sl] = block;
+    allocator->fl_bitmap |= (1u << fl);
+    allocator->sl_bitmap[fl] |= (1u << sl);
+}
+
+static void block_remove(tlsf_allocator* allocator, tlsf_block* block) {
+    i32 fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free_block(allocator, block, fl, sl);
+}
+
+static void block_insert(tlsf_allocator* allocator, tlsf_block* block) {
+    i32 fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    insert_free_block(allocator, block, fl, sl);
+}
+
+// Splits the tail off the block if it is large enough to hold a block of its own, and
+// returns the tail to the free lists.
+static void block_trim(tlsf_allocator* allocator, tlsf_block* block, u64 size) {
+    if (block_size(block) < size + TLSF_BLOCK_HEADER_SIZE + TLSF_BLOCK_SIZE_MIN) {
+        return;
+    }
+
+    tlsf_block* remaining = (tlsf_block*)((u8*)block_to_ptr(block) + size);
+    remaining->size = block_size(block) - size - TLSF_BLOCK_HEADER_SIZE;
+    remaining->prev_phys = block;
+    block_set_free(remaining, TRUE);
+    block_next(remaining)->prev_phys = remaining;
+    block_set_size(block, size);
+
+    block_insert(allocator, remaining);
+}
+
+b8 tlsf_allocator_create(u64 total_size, void* memory, tlsf_allocator* out_allocator) {
+    if (!out_allocator) {
+        KERROR("tlsf_allocator_create requires a valid pointer to out_allocator.");
+        return FALSE;
+    }
+    platform_zero_memory(out_allocator, sizeof(tlsf_allocator));
+
+    // Room is needed for at least one block plus the end sentinel.
+    u64 usable = (total_size & ~(u64)(TLSF_ALIGNMENT - 1));
+    if (usable < TLSF_BLOCK_HEADER_SIZE * 2 + TLSF_BLOCK_SIZE_MIN) {
+        KERROR("tlsf_allocator_create - total_size of %llu is too small.", total_size);
+        return FALSE;
+    }
+    if (usable - TLSF_BLOCK_HEADER_SIZE * 2 >= (1ull << TLSF_FL_INDEX_MAX)) {
+        KERROR("tlsf_allocator_create - total_size of %llu is too large.", total_size);
+        return FALSE;
+    }
+    if (memory && ((u64)memory & (TLSF_ALIGNMENT - 1))) {
+        KERROR("tlsf_allocator_create - memory must be aligned to %d bytes.", TLSF_ALIGNMENT);
+        return FALSE;
+    }
+
+    out_allocator->owns_memory = memory == 0;
+    out_allocator->memory = memory ? memory : platform_allocate(total_size, TRUE);
+    if (!out_allocator->memory) {
+        KERROR("tlsf_allocator_create - failed to reserve %llu bytes.", total_size);
+        return FALSE;
+    }
+    out_allocator->total_size = usable;
+
+    // One free block spanning everything, followed by a zero-sized used sentinel so that
+    // the last real block always has a next physical block.
+    tlsf_block* block = (tlsf_block*)out_allocator->memory;
+    block->prev_phys = 0;
+    block->size = usable - TLSF_BLOCK_HEADER_SIZE * 2;
+    block_set_free(block, TRUE);
+
+    tlsf_block* sentinel = block_next(block);
+    sentinel->prev_phys = block;
+    sentinel->size = 0;
+
+    block_insert(out_allocator, block);
+    out_allocator->allocated = TLSF_BLOCK_HEADER_SIZE;
+    return TRUE;
+}
+
+void tlsf_allocator_destroy(tlsf_allocator* allocator) {
+    if (!allocator) {
+        return;
+    }
+
+    if (allocator->owns_memory && allocator->memory) {
+        platform_free(allocator->memory, TRUE);
+    }
+    platform_zero_memory(allocator, sizeof(tlsf_allocator));
+}
+
+void* tlsf_allocator_allocate(tlsf_allocator* allocator, u64 size) {
+    if (!allocator || !allocator->memory) {
+        KERROR("tlsf_allocator_allocate - allocator not initialized.");
+        return 0;
+    }
+    if (size == 0 || size >= (1ull << TLSF_FL_INDEX_MAX)) {
+        return 0;
+    }
+
+    u64 adjusted = align_up(size, TLSF_ALIGNMENT);
+    if (adjusted < TLSF_BLOCK_SIZE_MIN) {
+        adjusted = TLSF_BLOCK_SIZE_MIN;
+    }
+
+    i32 fl, sl;
+    mapping_search(adjusted, &fl, &sl);
+    tlsf_block* block = find_suitable_block(allocator, &fl, &sl);
+    if (!block) {
+        return 0;
+    }
+
+    remove_free_block(allocator, block, fl, sl);
+    block_trim(allocator, block, adjusted);
+    block_set_free(block, FALSE);
+
+    allocator->allocated += block_size(block) + TLSF_BLOCK_HEADER_SIZE;
+    return block_to_ptr(block);
+}
+
+void* tlsf_allocator_allocate_aligned(tlsf_allocator* allocator, u64 size, u64 alignment) {
+    if (alignment <= TLSF_ALIGNMENT) {
+        return tlsf_allocator_allocate(allocator, size);
+    }
+    if (!allocator || !allocator->memory) {
+        KERROR("tlsf_allocator_allocate_aligned - allocator not initialized.");
+        return 0;
+    }
+    if ((alignment & (alignment - 1)) != 0) {
+        KERROR("tlsf_allocator_allocate_aligned - alignment of %llu is not a power of 2.", alignment);
+        return 0;
+    }
+    if (size == 0 || size + alignment >= (1ull << TLSF_FL_INDEX_MAX)) {
+        return 0;
+    }
+
+    u64 adjusted = align_up(size, TLSF_ALIGNMENT);
+    if (adjusted < TLSF_BLOCK_SIZE_MIN) {
+        adjusted = TLSF_BLOCK_SIZE_MIN;
+    }
+
+    // Any gap in front of the aligned address has to be large enough to become a free
+    // block of its own, so ask for enough room to skip to the next aligned address.
+    const u64 gap_minimum = TLSF_BLOCK_HEADER_SIZE + TLSF_BLOCK_SIZE_MIN;
+    u64 search_size = adjusted + alignment + gap_minimum;
+
+    i32 fl, sl;
+    mapping_search(search_size, &fl, &sl);
+    tlsf_block* block = find_suitable_block(allocator, &fl, &sl);
+    if (!block) {
+        return 0;
+    }
+    remove_free_block(allocator, block, fl, sl);
+
+    u64 ptr = (u64)block_to_ptr(block);
+    u64 aligned = align_up(ptr, alignment);
+    u64 gap = aligned - ptr;
+    if (gap && gap < gap_minimum) {
+        aligned = align_up(ptr + gap_minimum, alignment);
+        gap = aligned - ptr;
+    }
+
+    if (gap) {
+        // Split the gap off as a free block. Its previous neighbour cannot be free,
+        // since free blocks are always merged, so it goes straight back to the lists.
+        tlsf_block* aligned_block = block_from_ptr((void*)aligned);
+        aligned_block->size = block_size(block) - gap;
+        aligned_block->prev_phys = block;
+        block_next(aligned_block)->prev_phys = aligned_block;
+        block_set_size(block, gap - TLSF_BLOCK_HEADER_SIZE);
+        block_insert(allocator, block);
+        block = aligned_block;
+    }
+
+    block_trim(allocator, block, adjusted);
+    block_set_free(block, FALSE);
+
+    allocator->allocated += block_size(block) + TLSF_BLOCK_HEADER_SIZE;
+    return block_to_ptr(block);
+}
+
+b8 tlsf_allocator_free(tlsf_allocator* allocator, void* ptr) {
+    if (!allocator || !ptr) {
+        return FALSE;
+    }
+    if (!tlsf_allocator_owns(allocator, ptr)) {
+        KERROR("tlsf_allocator_free - block %p is not owned by this allocator.", ptr);
+        return FALSE;
+    }
+
+    tlsf_block* block = block_from_ptr(ptr);
+    if (block_is_free(block)) {
+        KERROR("tlsf_allocator_free - block %p was already freed.", ptr);
+        return FALSE;
+    }
+    allocator->allocated -= block_size(block) + TLSF_BLOCK_HEADER_SIZE;
+    block_set_free(block, TRUE);
+
+    // Merge with the previous physical block.
+    tlsf_block* prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        block_remove(allocator, prev);
+        block_set_size(prev, block_size(prev) + TLSF_BLOCK_HEADER_SIZE + block_size(block));
+        block = prev;
+        block_next(block)->prev_phys = block;
+    }
+
+    // Merge with the next physical block. The sentinel is never free.
+    tlsf_block* next = block_next(block);
+    if (block_is_free(next)) {
+        block_remove(allocator, next);
+        block_set_size(block, block_size(block) + TLSF_BLOCK_HEADER_SIZE + block_size(next));
+        block_next(block)->prev_phys = block;
+    }
+
+    block_insert(allocator, block);
+    return TRUE;
+}
+
+b8 tlsf_allocator_owns(const tlsf_allocator* allocator, const void* block) {
+    if (!allocator || !allocator->memory) {
+        return FALSE;
+    }
+    const u8* start = (const u8*)allocator->memory;
+    return (const u8*)block >= start && (const u8*)block < start + allocator->total_size;
+}
+
+u64 tlsf_allocator_block_size(const void* block) {
+    return block ? block_size(block_from_ptr(block)) : 0;
+}
+
+u64 tlsf_allocator_free_space(const tlsf_allocator* allocator) {
+    return allocator ? allocator->total_size - allocator->allocated : 0;
+}
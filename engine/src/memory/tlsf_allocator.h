@@ -0,0 +1,77 @@
+#pragma once
+
+#include "defines.h"
+
+// Every block handed out by the allocator is aligned to this many bytes.
+#define TLSF_ALIGNMENT 16
+
+// Number of second level subdivisions per first level class, as a power of 2.
+#define TLSF_SL_INDEX_COUNT_LOG2 5
+#define TLSF_SL_INDEX_COUNT (1 << TLSF_SL_INDEX_COUNT_LOG2)
+
+// Blocks below this size all land in the first level class 0.
+#define TLSF_FL_INDEX_SHIFT (TLSF_SL_INDEX_COUNT_LOG2 + 4)
+#define TLSF_SMALL_BLOCK_SIZE (1 << TLSF_FL_INDEX_SHIFT)
+
+// Largest supported block is 2^TLSF_FL_INDEX_MAX bytes.
+#define TLSF_FL_INDEX_MAX 40
+#define TLSF_FL_INDEX_COUNT (TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+
+struct tlsf_block;
+
+/**
+ * A two-level segregated fit (TLSF) general purpose allocator. It sub-allocates a single
+ * block of memory with O(1) allocate and free: free blocks are kept in lists segregated by
+ * size class, and two levels of bitmaps find the first non-empty class with a bit scan.
+ * Neighbouring free blocks are merged immediately on free to keep fragmentation low.
+ */
+typedef struct tlsf_allocator {
+    u64 total_size;
+    // Bytes currently handed out, including block headers.
+    u64 allocated;
+    void* memory;
+    b8 owns_memory;
+
+    u32 fl_bitmap;
+    u32 sl_bitmap[TLSF_FL_INDEX_COUNT];
+    struct tlsf_block* blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+} tlsf_allocator;
+
+/**
+ * Creates a TLSF allocator.
+ * @param total_size The size of the managed block in bytes.
+ * @param memory A block of at least total_size bytes, aligned to TLSF_ALIGNMENT, or 0 to
+ * have the allocator reserve its own from the platform. The caller keeps ownership of memory.
+ * @param out_allocator A pointer to hold the created allocator.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 tlsf_allocator_create(u64 total_size, void* memory, tlsf_allocator* out_allocator);
+KAPI void tlsf_allocator_destroy(tlsf_allocator* allocator);
+
+/**
+ * Allocates a block of at least the given size.
+ * @returns A pointer to the block, or 0 if no free block is large enough.
+ */
+KAPI void* tlsf_allocator_allocate(tlsf_allocator* allocator, u64 size);
+
+/**
+ * Allocates a block of at least the given size whose address is a multiple of the given
+ * power of 2 alignment. Free it with tlsf_allocator_free like any other block.
+ * @returns A pointer to the block, or 0 if no free block is large enough.
+ */
+KAPI void* tlsf_allocator_allocate_aligned(tlsf_allocator* allocator, u64 size, u64 alignment);
+
+/**
+ * Returns a block to the allocator.
+ * @returns TRUE on success; FALSE if the block is not owned by this allocator.
+ */
+KAPI b8 tlsf_allocator_free(tlsf_allocator* allocator, void* block);
+
+// TRUE if the given pointer lies within the memory managed by the allocator.
+KAPI b8 tlsf_allocator_owns(const tlsf_allocator* allocator, const void* block);
+
+// The usable size of a block previously returned by the allocator.
+KAPI u64 tlsf_allocator_block_size(const void* block);
+
+// Bytes not currently handed out, including the headers of free blocks.
+KAPI u64 tlsf_allocator_free_space(const tlsf_allocator* allocator);
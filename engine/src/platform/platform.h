@@ -6,20 +6,85 @@ typedef struct platform_state {
     void* internal_state;
 } platform_state;
 
+/**
+ * Starts up the platform layer and creates the application window. A headless platform
+ * creates no window and needs no display server; it pumps no messages, so input has to
+ * come from a playback, and everything else (memory, time, console) works as usual.
+ * A windowed startup falls back to headless when no display can be opened.
+ * @param headless Whether to start without a window.
+ * @param pump_thread Whether to read window messages on a dedicated thread, so they are
+ * read and timestamped as they arrive however long a frame takes. platform_pump_messages
+ * then only hands over what the thread has read. Ignored where unsupported.
+ * @returns TRUE on success; otherwise FALSE.
+ */
 b8 platform_startup(
     platform_state* plat_state,
     const char* application_name,
     i32 x,
     i32 y,
     i32 width,
-    i32 height);
+    i32 height,
+    b8 headless,
+    b8 pump_thread);
 
 void platform_shutdown(platform_state* plat_state);
 
 b8 platform_pump_messages(platform_state* plat_state);
 
+// Alignment used by platform_allocate when aligned is set. One cache line.
+#define PLATFORM_DEFAULT_ALIGNMENT 64
+
+/**
+ * Allocates a block from the system. Aligned blocks start on a PLATFORM_DEFAULT_ALIGNMENT
+ * boundary. The aligned flag must be passed the same way to platform_free.
+ */
 KAPI void* platform_allocate(u64 size, b8 aligned);
+
+/**
+ * Allocates a block from the system aligned to the given power of 2 alignment. Free it
+ * with platform_free with aligned set.
+ */
+KAPI void* platform_allocate_aligned(u64 size, u64 alignment);
 KAPI void platform_free(void* block, b8 aligned);
+
+/**
+ * Maps whole pages straight from the OS, for large long-lived blocks such as heaps,
+ * arenas, pools and asset buffers. With huge_pages set, explicit huge pages are tried
+ * first, then transparent huge pages, then regular pages.
+ * @param size The size of the block in bytes. Rounded up to a whole number of pages.
+ * @param huge_pages Whether to back the block with huge pages, if the OS allows.
+ * @returns A page aligned block, or 0 on failure.
+ */
+KAPI void* platform_allocate_pages(u64 size, b8 huge_pages);
+
+// Returns a block from platform_allocate_pages. size and huge_pages must match the allocation.
+KAPI void platform_free_pages(void* block, u64 size, b8 huge_pages);
+// The granularity of page mappings and commits, in bytes.
+KAPI u64 platform_get_page_size();
+
+/**
+ * Reserves a range of address space without backing it with memory. Nothing in the range
+ * can be touched until it is committed with platform_commit_memory.
+ * @param size The size of the range in bytes. Rounded up to a whole number of pages.
+ * @returns The page aligned start of the range, or 0 on failure.
+ */
+KAPI void* platform_reserve_memory(u64 size);
+
+/**
+ * Backs part of a reserved range with readable and writable memory. The range is zeroed
+ * the first time it is committed.
+ * @param block The page aligned start of the part to commit.
+ * @param size The size of the part in bytes. Rounded up to a whole number of pages.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 platform_commit_memory(void* block, u64 size);
+
+// Returns the memory behind part of a reserved range to the OS, keeping the range reserved.
+KAPI void platform_decommit_memory(void* block, u64 size);
+
+// Releases a whole range obtained from platform_reserve_memory. size must match the reservation.
+KAPI void platform_release_memory(void* block, u64 size);
+
 void* platform_zero_memory(void* block, u64 size);
 void* platform_copy_memory(void* dest, const void* source, u64 size);
 void* platform_set_memory(void* dest, i32 value, u64 size);
@@ -27,9 +92,169 @@ void* platform_set_memory(void* dest, i32 value, u64 size);
 void platform_console_write(const char* message, u8 colour);
 void platform_console_write_error(const char* message, u8 colour);
 
-f64 platform_get_absolute_time();
+// Seconds on a monotonic clock with an arbitrary origin.
+KAPI f64 platform_get_absolute_time();
+
+/**
+ * Nanoseconds on the same monotonic clock as platform_get_absolute_time, without the
+ * loss of precision of a floating point count of seconds.
+ */
+KAPI u64 platform_get_absolute_time_ns();
+
+/**
+ * Reads the cheapest monotonic counter the platform has: the CPU's timestamp counter
+ * where it is invariant and the OS trusts it, otherwise the OS clock. Meant for timing
+ * short stretches of code many times per frame; take the difference of two readings and
+ * convert it with platform_ticks_to_ns.
+ */
+KAPI u64 platform_get_ticks();
+
+// Converts a number of ticks from platform_get_ticks to nanoseconds.
+KAPI u64 platform_ticks_to_ns(u64 ticks);
+
+/**
+ * Blocks the calling thread until platform_get_absolute_time_ns reaches the deadline.
+ * The thread sleeps in the OS for most of the wait and spins for the last stretch; the
+ * length of that stretch follows how late the OS has been waking this thread, so the
+ * wait ends close to the deadline while using as little CPU as the OS allows.
+ * Returns at once if the deadline has passed.
+ */
+KAPI void platform_sleep_until(u64 deadline_ns);
 
 // Sleep on the thread for the provided ms. This blocks the main thread.
 // Should only be used for giving time back to the OS for unused update power.
 // Therefore it is not exported.
-void platform_sleep(u64 ms);
\ No newline at end of file
+void platform_sleep(u64 ms);
+
+// Threading
+
+// Timeout for the wait functions that never gives up.
+#define PLATFORM_WAIT_INFINITE 0xFFFFFFFFFFFFFFFFull
+
+// Entry point of a thread. The return value is the thread's exit code.
+typedef u32 (*PFN_thread_start)(void* params);
+
+typedef struct platform_thread {
+    // The OS handle of the thread.
+    u64 handle;
+    // The same id platform_get_current_thread_id returns on the thread.
+    u64 thread_id;
+} platform_thread;
+
+/**
+ * The synchronisation primitives below hold the OS object in place. Create them where
+ * they will stay; they must not be copied or moved until destroyed.
+ */
+typedef struct platform_mutex {
+    alignas(8) u8 internal_data[64];
+} platform_mutex;
+
+typedef struct platform_semaphore {
+    alignas(8) u8 internal_data[64];
+} platform_semaphore;
+
+typedef struct platform_condition {
+    alignas(8) u8 internal_data[64];
+} platform_condition;
+
+/**
+ * Starts a thread.
+ * @param start The function the thread runs.
+ * @param params Passed to start.
+ * @param name Shown by debuggers and profilers, or 0. Linux keeps the first 15 characters.
+ * @param out_thread Receives the thread, to join it and set its affinity.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 platform_thread_create(PFN_thread_start start, void* params, const char* name, platform_thread* out_thread);
+
+// Waits for a thread to finish and releases it. Every created thread must be joined.
+KAPI b8 platform_thread_join(platform_thread* thread);
+
+/**
+ * Pins a thread to a set of logical processors.
+ * @param thread The thread to pin, or 0 for the calling thread.
+ * @param processor_mask Bit n allows logical processor n. Covers the first 64 processors;
+ * on Windows, the first 64 of processor group 0 only.
+ * @returns TRUE on success; otherwise FALSE.
+ */
+KAPI b8 platform_thread_set_affinity(platform_thread* thread, u64 processor_mask);
+
+// Names the calling thread, for threads the engine did not create such as the main one.
+KAPI void platform_thread_set_current_name(const char* name);
+
+KAPI u64 platform_get_current_thread_id();
+
+KAPI b8 platform_mutex_create(platform_mutex* mutex);
+KAPI void platform_mutex_destroy(platform_mutex* mutex);
+KAPI void platform_mutex_lock(platform_mutex* mutex);
+// Takes the mutex if it is free. Returns TRUE if it was taken.
+KAPI b8 platform_mutex_try_lock(platform_mutex* mutex);
+KAPI void platform_mutex_unlock(platform_mutex* mutex);
+
+KAPI b8 platform_semaphore_create(platform_semaphore* semaphore, u32 initial_count);
+KAPI void platform_semaphore_destroy(platform_semaphore* semaphore);
+// Adds one to the count, waking a waiting thread if any.
+KAPI void platform_semaphore_signal(platform_semaphore* semaphore);
+/**
+ * Waits until the count is above zero and takes one from it.
+ * @param timeout_ms How long to wait, or PLATFORM_WAIT_INFINITE.
+ * @returns TRUE if the count was taken; FALSE on timeout.
+ */
+KAPI b8 platform_semaphore_wait(platform_semaphore* semaphore, u64 timeout_ms);
+
+KAPI b8 platform_condition_create(platform_condition* condition);
+KAPI void platform_condition_destroy(platform_condition* condition);
+/**
+ * Unlocks the mutex, waits for the condition to be signalled and locks the mutex again.
+ * Wake-ups can be spurious, so check the awaited state in a loop.
+ * @param mutex A mutex the calling thread holds.
+ * @param timeout_ms How long to wait, or PLATFORM_WAIT_INFINITE.
+ * @returns TRUE if woken; FALSE on timeout.
+ */
+KAPI b8 platform_condition_wait(platform_condition* condition, platform_mutex* mutex, u64 timeout_ms);
+// Wakes one waiting thread.
+KAPI void platform_condition_signal(platform_condition* condition);
+// Wakes every waiting thread.
+KAPI void platform_condition_broadcast(platform_condition* condition);
+
+typedef struct platform_cpu_info {
+    u32 logical_processors;
+    u32 physical_cores;
+    // Sizes in bytes of the data caches seen by one core, 0 where unknown.
+    u32 cache_line_size;
+    u32 l1_data_cache_size;
+    u32 l2_cache_size;
+    u32 l3_cache_size;
+} platform_cpu_info;
+
+// Describes the processors and caches of the machine, to size and place worker threads.
+KAPI void platform_get_cpu_info(platform_cpu_info* out_info);
+
+/**
+ * Atomic operations on plain integers, for C-style structures shared between threads
+ * that cannot hold std::atomic. Loads acquire, stores release and read-modify-writes are
+ * sequentially consistent.
+ */
+static inline u32 platform_atomic_load_u32(const volatile u32* value) { return __atomic_load_n(value, __ATOMIC_ACQUIRE); }
+static inline u64 platform_atomic_load_u64(const volatile u64* value) { return __atomic_load_n(value, __ATOMIC_ACQUIRE); }
+static inline void platform_atomic_store_u32(volatile u32* value, u32 desired) { __atomic_store_n(value, desired, __ATOMIC_RELEASE); }
+static inline void platform_atomic_store_u64(volatile u64* value, u64 desired) { __atomic_store_n(value, desired, __ATOMIC_RELEASE); }
+// Return the value before the addition.
+static inline u32 platform_atomic_fetch_add_u32(volatile u32* value, u32 addend) { return __atomic_fetch_add(value, addend, __ATOMIC_SEQ_CST); }
+static inline u64 platform_atomic_fetch_add_u64(volatile u64* value, u64 addend) { return __atomic_fetch_add(value, addend, __ATOMIC_SEQ_CST); }
+// Replace the value with desired if it equals expected. Return TRUE if it was replaced.
+static inline b8 platform_atomic_compare_exchange_u32(volatile u32* value, u32 expected, u32 desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline b8 platform_atomic_compare_exchange_u64(volatile u64* value, u64 expected, u64 desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Tells the CPU the thread is spin-waiting, to save power and yield to a sibling hyperthread.
+static inline void platform_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
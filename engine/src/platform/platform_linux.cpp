@@ -6,24 +6,77 @@
 #include "core/logger.h"
 #include "core/event.h"
 #include "core/input.h"
+#include "containers/spsc_queue.h"
 
 #include <xcb/xcb.h>
+#include <xcb/xkb.h>  // sudo apt-get install libxcb-xkb-dev
+#include <xkbcommon/xkbcommon.h>
+#include <xkbcommon/xkbcommon-x11.h>
 #include <X11/keysym.h>
 #include <X11/XKBlib.h>  // sudo apt-get install libx11-dev
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>  // sudo apt-get install libxkbcommon-x11-dev
 #include <sys/time.h>
+#include <sys/mman.h>
 
 #if _POSIX_C_SOURCE >= 199309L
 #include <time.h>  // nanosleep
-#else
-#include <unistd.h>  // usleep
 #endif
+#include <unistd.h>  // usleep, sysconf
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <atomic>
+#include <new>
+
+// The TSC is read directly where the CPU has one.
+#if defined(__x86_64__) || defined(__i386__)
+#define KPLATFORM_TSC 1
+#include <cpuid.h>
+#include <x86intrin.h>
+#else
+#define KPLATFORM_TSC 0
+#endif
+
+// sem_clockwait, which takes a CLOCK_MONOTONIC deadline, arrived in glibc 2.30.
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 30)
+#define KPLATFORM_SEM_CLOCKWAIT 1
+#endif
+#endif
+#ifndef KPLATFORM_SEM_CLOCKWAIT
+#define KPLATFORM_SEM_CLOCKWAIT 0
+#endif
+
+// Messages the pump thread can read ahead of the main thread.
+#define PLATFORM_MESSAGE_QUEUE_CAPACITY 4096
+
+typedef enum platform_message_type {
+    PLATFORM_MESSAGE_KEY,
+    PLATFORM_MESSAGE_BUTTON,
+    PLATFORM_MESSAGE_MOUSE_MOVE,
+    // x and y hold the new width and height.
+    PLATFORM_MESSAGE_RESIZE,
+    PLATFORM_MESSAGE_QUIT
+} platform_message_type;
+
+// An X event translated for the engine, stamped with when it was read.
+typedef struct platform_message {
+    f64 time;
+    u32 os_time;
+    u8 type;
+    b8 pressed;
+    u16 code;
+    i16 x;
+    i16 y;
+} platform_message;
+
 typedef struct internal_state {
     Display* display;
     xcb_connection_t* connection;
@@ -31,24 +84,65 @@ typedef struct internal_state {
     xcb_screen_t* screen;
     xcb_atom_t wm_protocols;
     xcb_atom_t wm_delete_win;
+    // Last known client size, to tell resizes from moves.
+    u16 width;
+    u16 height;
+
+    // The key each X keycode stands for, rebuilt whenever the keymap changes.
+    u8 keycode_table[256];
+    struct xkb_context* xkb_context;
+    i32 xkb_device_id;
+    // Event code of the XKB extension's events, or 0 without the extension.
+    u8 xkb_first_event;
+
+    // No display or window; pumping messages does nothing.
+    b8 headless;
+
+    // Pump thread mode: the thread blocks on the connection and the main thread drains
+    // the messages it translated.
+    b8 pump_thread_running;
+    platform_thread pump_thread;
+    std::atomic<b8> pump_stop;
+    spsc_queue<platform_message> messages;
 } internal_state;
 
 // Key translation
 keys translate_keycode(u32 x_keycode);
 
+static u32 platform_pump_thread(void* params);
+static void platform_build_keycode_table(internal_state* state);
+
 b8 platform_startup(
     platform_state* plat_state,
     const char* application_name,
     i32 x,
     i32 y,
     i32 width,
-    i32 height) {
+    i32 height,
+    b8 headless,
+    b8 pump_thread) {
     // Create the internal state.
-    plat_state->internal_state = malloc(sizeof(internal_state));
+    // Value-initialized, so every field starts zeroed.
+    plat_state->internal_state = new (malloc(sizeof(internal_state))) internal_state();
     internal_state* state = (internal_state*)plat_state->internal_state;
 
-    // Connect to X
-    state->display = XOpenDisplay(NULL);
+    if (!headless) {
+        // The pump thread may rebuild the key table through Xlib while the main thread uses it.
+        if (pump_thread) {
+            XInitThreads();
+        }
+
+        // Connect to X
+        state->display = XOpenDisplay(NULL);
+        if (!state->display) {
+            KWARN("Failed to open the X display, running headless.");
+        }
+    }
+    if (!state->display) {
+        state->headless = TRUE;
+        KINFO("Platform started headless.");
+        return TRUE;
+    }
 
     // Turn off key repeats.
     XAutoRepeatOff(state->display);
@@ -61,6 +155,25 @@ b8 platform_startup(
         return FALSE;
     }
 
+    // Load the keymap through XKB and ask to be told when it changes.
+    if (xkb_x11_setup_xkb_extension(
+            state->connection,
+            XKB_X11_MIN_MAJOR_XKB_VERSION,
+            XKB_X11_MIN_MINOR_XKB_VERSION,
+            XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
+            0, 0, &state->xkb_first_event, 0)) {
+        state->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+        state->xkb_device_id = xkb_x11_get_core_keyboard_device_id(state->connection);
+        u16 xkb_events = XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY | XCB_XKB_EVENT_TYPE_MAP_NOTIFY;
+        u16 map_parts = XCB_XKB_MAP_PART_KEY_TYPES | XCB_XKB_MAP_PART_KEY_SYMS | XCB_XKB_MAP_PART_MODIFIER_MAP;
+        xcb_xkb_select_events(state->connection, (xcb_xkb_device_spec_t)state->xkb_device_id,
+                              xkb_events, 0, xkb_events, map_parts, map_parts, 0);
+    } else {
+        KWARN("XKB is not available, translating keys through Xlib.");
+        state->xkb_first_event = 0;
+    }
+    platform_build_keycode_table(state);
+
     // Get data from the X server
     const struct xcb_setup_t* setup = xcb_get_setup(state->connection);
 
@@ -91,6 +204,9 @@ b8 platform_startup(
     // Values to be sent over XCB (bg colour, events)
     u32 value_list[] = {state->screen->black_pixel, event_values};
 
+    state->width = (u16)width;
+    state->height = (u16)height;
+
     // Create the window
     xcb_void_cookie_t cookie = xcb_create_window(
         state->connection,
@@ -161,111 +277,358 @@ b8 platform_startup(
         return FALSE;
     }
 
+    if (pump_thread) {
+        if (!state->messages.create(PLATFORM_MESSAGE_QUEUE_CAPACITY) ||
+            !platform_thread_create(platform_pump_thread, state, "kohi_x_pump", &state->pump_thread)) {
+            KWARN("Failed to start the pump thread, pumping messages on the main thread.");
+            state->messages.destroy();
+        } else {
+            state->pump_thread_running = TRUE;
+        }
+    }
+
     return TRUE;
 }
 
 void platform_shutdown(platform_state* plat_state) {
     // Simply cold-cast to the known type.
     internal_state* state = (internal_state*)plat_state->internal_state;
+    if (state->headless) {
+        return;
+    }
+
+    if (state->pump_thread_running) {
+        // Wake the thread out of xcb_wait_for_event with a message to our own window.
+        state->pump_stop.store(TRUE, std::memory_order_release);
+        xcb_client_message_event_t wake;
+        memset(&wake, 0, sizeof(wake));
+        wake.response_type = XCB_CLIENT_MESSAGE;
+        wake.format = 32;
+        wake.window = state->window;
+        wake.type = state->wm_protocols;
+        xcb_send_event(state->connection, 0, state->window, XCB_EVENT_MASK_NO_EVENT, (const char*)&wake);
+        xcb_flush(state->connection);
+        platform_thread_join(&state->pump_thread);
+        state->pump_thread_running = FALSE;
+        state->messages.destroy();
+    }
 
     // Turn key repeats back on since this is global for the OS... just... wow.
     XAutoRepeatOn(state->display);
 
+    if (state->xkb_context) {
+        xkb_context_unref(state->xkb_context);
+        state->xkb_context = 0;
+    }
+
     xcb_destroy_window(state->connection, state->window);
 }
 
-b8 platform_pump_messages(platform_state* plat_state) {
-    // Simply cold-cast to the known type.
-    internal_state* state = (internal_state*)plat_state->internal_state;
+// Translates an X event into a platform message. Returns FALSE for events the engine
+// does not handle.
+static b8 platform_translate_event(internal_state* state, xcb_generic_event_t* event, platform_message* out_message) {
+    out_message->time = platform_get_absolute_time();
+    out_message->os_time = 0;
+    out_message->pressed = FALSE;
+    out_message->code = 0;
+    out_message->x = 0;
+    out_message->y = 0;
 
-    xcb_generic_event_t* event;
-    xcb_client_message_event_t* cm;
+    switch (event->response_type & ~0x80) {
+        case XCB_KEY_PRESS:
+        case XCB_KEY_RELEASE: {
+            // Key press event - xcb_key_press_event_t and xcb_key_release_event_t are the same
+            xcb_key_press_event_t *kb_event = (xcb_key_press_event_t *)event;
+            out_message->type = PLATFORM_MESSAGE_KEY;
+            out_message->pressed = event->response_type == XCB_KEY_PRESS;
+            out_message->code = state->keycode_table[kb_event->detail];
+            // The server timestamp.
+            out_message->os_time = kb_event->time;
+        } return TRUE;
+        case XCB_BUTTON_PRESS:
+        case XCB_BUTTON_RELEASE: {
+            xcb_button_press_event_t *mouse_event = (xcb_button_press_event_t *)event;
+            buttons mouse_button = BUTTON_MAX_BUTTONS;
+            switch (mouse_event->detail) {
+                case XCB_BUTTON_INDEX_1:
+                    mouse_button = BUTTON_LEFT;
+                    break;
+                case XCB_BUTTON_INDEX_2:
+                    mouse_button = BUTTON_MIDDLE;
+                    break;
+                case XCB_BUTTON_INDEX_3:
+                    mouse_button = BUTTON_RIGHT;
+                    break;
+            }
+            if (mouse_button == BUTTON_MAX_BUTTONS) {
+                return FALSE;
+            }
 
-    b8 quit_flagged = FALSE;
+            out_message->type = PLATFORM_MESSAGE_BUTTON;
+            out_message->pressed = event->response_type == XCB_BUTTON_PRESS;
+            out_message->code = (u16)mouse_button;
+            out_message->os_time = mouse_event->time;
+        } return TRUE;
+        case XCB_MOTION_NOTIFY: {
+            // Mouse move
+            xcb_motion_notify_event_t *move_event = (xcb_motion_notify_event_t *)event;
+            out_message->type = PLATFORM_MESSAGE_MOUSE_MOVE;
+            out_message->x = move_event->event_x;
+            out_message->y = move_event->event_y;
+            out_message->os_time = move_event->time;
+        } return TRUE;
+        case XCB_CONFIGURE_NOTIFY: {
+            // Sent for moves as well as resizes; only report a size change.
+            xcb_configure_notify_event_t *configure_event = (xcb_configure_notify_event_t *)event;
+            if (configure_event->width == state->width && configure_event->height == state->height) {
+                return FALSE;
+            }
+            state->width = configure_event->width;
+            state->height = configure_event->height;
 
-    // Poll for events until null is returned.
-    while (event != 0) {
-        event = xcb_poll_for_event(state->connection);
-        if (event == 0) {
+            out_message->type = PLATFORM_MESSAGE_RESIZE;
+            out_message->x = (i16)configure_event->width;
+            out_message->y = (i16)configure_event->height;
+        } return TRUE;
+        case XCB_CLIENT_MESSAGE: {
+            xcb_client_message_event_t* cm = (xcb_client_message_event_t*)event;
+
+            // Window close
+            if (cm->data.data32[0] != state->wm_delete_win) {
+                return FALSE;
+            }
+            out_message->type = PLATFORM_MESSAGE_QUIT;
+        } return TRUE;
+        case XCB_MAPPING_NOTIFY: {
+            xcb_mapping_notify_event_t* mapping_event = (xcb_mapping_notify_event_t*)event;
+            if (mapping_event->request == XCB_MAPPING_KEYBOARD) {
+                platform_build_keycode_table(state);
+            }
+        } return FALSE;
+        default:
+            // The keymap changed, or the keyboard was replaced by one with another keymap.
+            if (state->xkb_first_event && (event->response_type & ~0x80) == state->xkb_first_event) {
+                xcb_xkb_map_notify_event_t* xkb_event = (xcb_xkb_map_notify_event_t*)event;
+                if ((xkb_event->xkbType == XCB_XKB_NEW_KEYBOARD_NOTIFY || xkb_event->xkbType == XCB_XKB_MAP_NOTIFY) &&
+                    xkb_event->deviceID == state->xkb_device_id) {
+                    platform_build_keycode_table(state);
+                }
+            }
+            return FALSE;
+    }
+}
+
+/**
+ * Maps every X keycode to the key its unshifted keysym stands for, so translating a key
+ * event is a single table load. Keys are identified by their base keysym whatever
+ * modifiers are held; KEY_A is KEY_A with or without shift.
+ */
+static void platform_build_keycode_table(internal_state* state) {
+    struct xkb_keymap* keymap = 0;
+    if (state->xkb_context) {
+        keymap = xkb_x11_keymap_new_from_device(state->xkb_context, state->connection, state->xkb_device_id,
+                                                XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if (!keymap) {
+            KWARN("Failed to load the XKB keymap, translating keys through Xlib.");
+        }
+    }
+
+    // X keycodes start at 8.
+    for (u32 code = 0; code < 256; ++code) {
+        u32 key_sym = 0;
+        if (keymap) {
+            // Level 0 of the first layout: the keysym with no modifiers held.
+            const xkb_keysym_t* syms;
+            if (xkb_keymap_key_get_syms_by_level(keymap, code, 0, 0, &syms) > 0) {
+                key_sym = syms[0];
+            }
+        } else if (code >= 8) {
+            key_sym = XkbKeycodeToKeysym(state->display, (KeyCode)code, 0, 0);
+        }
+        state->keycode_table[code] = (u8)translate_keycode(key_sym);
+    }
+
+    if (keymap) {
+        xkb_keymap_unref(keymap);
+    }
+}
+
+// Hands a translated message to the engine, on the main thread. Returns FALSE on quit.
+static b8 platform_process_message(const platform_message* message) {
+    switch (message->type) {
+        case PLATFORM_MESSAGE_KEY:
+            input_process_key((keys)message->code, message->pressed, message->os_time, message->time);
+            break;
+        case PLATFORM_MESSAGE_BUTTON:
+            input_process_button((buttons)message->code, message->pressed, message->os_time, message->time);
+            break;
+        case PLATFORM_MESSAGE_MOUSE_MOVE:
+            input_process_mouse_move(message->x, message->y, message->os_time, message->time);
             break;
+        case PLATFORM_MESSAGE_RESIZE: {
+            // Queue the event; a burst of resizes is coalesced to the last one.
+            event_context context;
+            context.data.u16[0] = (u16)message->x;
+            context.data.u16[1] = (u16)message->y;
+            event_post(EVENT_CODE_RESIZED, 0, context);
+        } break;
+        case PLATFORM_MESSAGE_QUIT:
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Blocks on the X connection and forwards every translated event to the main thread.
+static u32 platform_pump_thread(void* params) {
+    internal_state* state = (internal_state*)params;
+    while (!state->pump_stop.load(std::memory_order_acquire)) {
+        xcb_generic_event_t* event = xcb_wait_for_event(state->connection);
+        platform_message message;
+        if (!event) {
+            // The connection is gone; nothing more will arrive, so ask the application to quit.
+            message.time = platform_get_absolute_time();
+            message.type = PLATFORM_MESSAGE_QUIT;
+        } else {
+            b8 translated = platform_translate_event(state, event, &message);
+            free(event);
+            if (!translated) {
+                continue;
+            }
         }
 
-        // Input events
-        switch (event->response_type & ~0x80) {
-            case XCB_KEY_PRESS:
-            case XCB_KEY_RELEASE: {
-                // Key press event - xcb_key_press_event_t and xcb_key_release_event_t are the same
-                xcb_key_press_event_t *kb_event = (xcb_key_press_event_t *)event;
-                b8 pressed = event->response_type == XCB_KEY_PRESS;
-                xcb_keycode_t code = kb_event->detail;
-                KeySym key_sym = XkbKeycodeToKeysym(
-                    state->display,
-                    (KeyCode)code,  //event.xkey.keycode,
-                    0,
-                    code & ShiftMask ? 1 : 0);
-
-                keys key = translate_keycode(key_sym);
-
-                // Pass to the input subsystem for processing.
-                input_process_key(key, pressed);
-            } break;
-            case XCB_BUTTON_PRESS:
-            case XCB_BUTTON_RELEASE: {
-                xcb_button_press_event_t *mouse_event = (xcb_button_press_event_t *)event;
-                b8 pressed = event->response_type == XCB_BUTTON_PRESS;
-                buttons mouse_button = BUTTON_MAX_BUTTONS;
-                switch (mouse_event->detail) {
-                    case XCB_BUTTON_INDEX_1:
-                        mouse_button = BUTTON_LEFT;
-                        break;
-                    case XCB_BUTTON_INDEX_2:
-                        mouse_button = BUTTON_MIDDLE;
-                        break;
-                    case XCB_BUTTON_INDEX_3:
-                        mouse_button = BUTTON_RIGHT;
-                        break;
-                }
+        // If the main thread falls this far behind, wait for it rather than drop input.
+        while (!state->messages.enqueue(message)) {
+            if (state->pump_stop.load(std::memory_order_acquire)) {
+                return 0;
+            }
+            platform_sleep(1);
+        }
+        if (!event) {
+            break;
+        }
+    }
+    return 0;
+}
 
-                // Pass over to the input subsystem.
-                if (mouse_button != BUTTON_MAX_BUTTONS) {
-                    input_process_button(mouse_button, pressed);
-                }
-            } break;
-            case XCB_MOTION_NOTIFY: {
-                // Mouse move
-                xcb_motion_notify_event_t *move_event = (xcb_motion_notify_event_t *)event;
-
-                // Pass over to the input subsystem.
-                input_process_mouse_move(move_event->event_x, move_event->event_y);
-            } break;
-            case XCB_CONFIGURE_NOTIFY: {
-                // TODO: Resizing
-            } break;
-
-            case XCB_CLIENT_MESSAGE: {
-                cm = (xcb_client_message_event_t*)event;
-
-                // Window close
-                if (cm->data.data32[0] == state->wm_delete_win) {
-                    quit_flagged = TRUE;
-                }
-            } break;
-            default:
-                // Something else
-                break;
+b8 platform_pump_messages(platform_state* plat_state) {
+    // Simply cold-cast to the known type.
+    internal_state* state = (internal_state*)plat_state->internal_state;
+    if (state->headless) {
+        return TRUE;
+    }
+
+    b8 quit_flagged = FALSE;
+    platform_message message;
+
+    if (state->pump_thread_running) {
+        // Drain what the pump thread has read since the last frame.
+        while (state->messages.dequeue(&message)) {
+            quit_flagged |= !platform_process_message(&message);
         }
+        return !quit_flagged;
+    }
 
+    // Poll for events until null is returned.
+    xcb_generic_event_t* event;
+    while ((event = xcb_poll_for_event(state->connection)) != 0) {
+        if (platform_translate_event(state, event, &message)) {
+            quit_flagged |= !platform_process_message(&message);
+        }
         free(event);
     }
     return !quit_flagged;
 }
 
+// Size of a huge page on x86_64 and most aarch64 kernels.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 void* platform_allocate(u64 size, b8 aligned) {
+    if (aligned) {
+        return platform_allocate_aligned(size, PLATFORM_DEFAULT_ALIGNMENT);
+    }
     return malloc(size);
 }
+void* platform_allocate_aligned(u64 size, u64 alignment) {
+    // posix_memalign requires at least pointer alignment.
+    if (alignment < sizeof(void*)) {
+        alignment = sizeof(void*);
+    }
+    void* block = 0;
+    if (posix_memalign(&block, alignment, size) != 0) {
+        return 0;
+    }
+    return block;
+}
 void platform_free(void* block, b8 aligned) {
+    // posix_memalign blocks are released with free() as well.
     free(block);
 }
+static u64 platform_page_round(u64 size, b8 huge_pages) {
+    u64 page_size = huge_pages ? HUGE_PAGE_SIZE : platform_get_page_size();
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+void* platform_allocate_pages(u64 size, b8 huge_pages) {
+    u64 length = platform_page_round(size, huge_pages);
+    if (!huge_pages) {
+        void* block = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return block == MAP_FAILED ? 0 : block;
+    }
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only succeed if the admin reserved some (vm.nr_hugepages).
+    void* block = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block != MAP_FAILED) {
+        return block;
+    }
+#endif
+
+    // Fall back to transparent huge pages. The kernel only uses them for huge page aligned
+    // ranges, so over-map and trim the unaligned head and tail.
+    u8* raw = (u8*)mmap(0, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return 0;
+    }
+    u8* aligned = (u8*)(((u64)raw + HUGE_PAGE_SIZE - 1) & ~(u64)(HUGE_PAGE_SIZE - 1));
+    if (aligned != raw) {
+        munmap(raw, aligned - raw);
+    }
+    u64 tail = (raw + length + HUGE_PAGE_SIZE) - (aligned + length);
+    if (tail) {
+        munmap(aligned + length, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+void platform_free_pages(void* block, u64 size, b8 huge_pages) {
+    if (block) {
+        munmap(block, platform_page_round(size, huge_pages));
+    }
+}
+u64 platform_get_page_size() {
+    static u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+void* platform_reserve_memory(u64 size) {
+    // PROT_NONE plus MAP_NORESERVE claims address space only; no memory or swap is charged.
+    void* block = mmap(0, platform_page_round(size, FALSE), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return block == MAP_FAILED ? 0 : block;
+}
+b8 platform_commit_memory(void* block, u64 size) {
+    return mprotect(block, platform_page_round(size, FALSE), PROT_READ | PROT_WRITE) == 0;
+}
+void platform_decommit_memory(void* block, u64 size) {
+    u64 length = platform_page_round(size, FALSE);
+    // Drop the pages first so the memory goes back to the OS, then make the range inaccessible.
+    madvise(block, length, MADV_DONTNEED);
+    mprotect(block, length, PROT_NONE);
+}
+void platform_release_memory(void* block, u64 size) {
+    if (block) {
+        munmap(block, platform_page_round(size, FALSE));
+    }
+}
 void* platform_zero_memory(void* block, u64 size) {
     return memset(block, 0, size);
 }
@@ -287,10 +650,149 @@ void platform_console_write_error(const char* message, u8 colour) {
     printf("\033[%sm%s\033[0m", colour_strings[colour], message);
 }
 
-f64 platform_get_absolute_time() {
+// How long the TSC is measured against the OS clock to find its frequency.
+#define PLATFORM_TSC_CALIBRATION_NS 10000000ull
+
+typedef struct platform_clock_state {
+    // Whether ticks are TSC cycles; otherwise they are CLOCK_MONOTONIC_RAW nanoseconds.
+    b8 use_tsc;
+    // Nanoseconds per tick as a 32.32 fixed point number.
+    u64 ns_per_tick;
+    // A TSC reading and the CLOCK_MONOTONIC_RAW time it was taken at.
+    u64 base_ticks;
+    u64 base_ns;
+} platform_clock_state;
+
+static u64 platform_clock_raw_ns() {
     struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    return now.tv_sec + now.tv_nsec * 0.000000001;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+#if KPLATFORM_TSC
+// The TSC is only a clock if it ticks at a constant rate in every power state, and only
+// if the kernel trusts it to stay in sync across cores; it stops using it if it does not.
+static b8 platform_tsc_usable() {
+    u32 eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, 0) < 0x80000007) {
+        return FALSE;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1 << 8))) {
+        return FALSE;
+    }
+
+    char clocksource[32] = {0};
+    FILE* file = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (!file) {
+        return FALSE;
+    }
+    b8 read = fgets(clocksource, sizeof(clocksource), file) != 0;
+    fclose(file);
+    return read && strncmp(clocksource, "tsc", 3) == 0;
+}
+#endif
+
+static platform_clock_state platform_clock_initialize() {
+    platform_clock_state clock = {};
+    clock.ns_per_tick = 1ull << 32;
+#if KPLATFORM_TSC
+    if (platform_tsc_usable()) {
+        // Count TSC cycles over a stretch of the OS clock.
+        u64 start_ns = platform_clock_raw_ns();
+        u64 start_ticks = __rdtsc();
+        u64 end_ns;
+        do {
+            end_ns = platform_clock_raw_ns();
+        } while (end_ns - start_ns < PLATFORM_TSC_CALIBRATION_NS);
+        u64 end_ticks = __rdtsc();
+
+        clock.use_tsc = TRUE;
+        clock.ns_per_tick = (u64)(((unsigned __int128)(end_ns - start_ns) << 32) / (end_ticks - start_ticks));
+        clock.base_ticks = end_ticks;
+        clock.base_ns = end_ns;
+    }
+#endif
+    return clock;
+}
+
+// The clock is set up on first use, which may come before platform_startup.
+static inline const platform_clock_state* platform_clock() {
+    static const platform_clock_state clock = platform_clock_initialize();
+    return &clock;
+}
+
+u64 platform_get_ticks() {
+#if KPLATFORM_TSC
+    if (platform_clock()->use_tsc) {
+        return __rdtsc();
+    }
+#endif
+    return platform_clock_raw_ns();
+}
+
+u64 platform_ticks_to_ns(u64 ticks) {
+    return (u64)(((unsigned __int128)ticks * platform_clock()->ns_per_tick) >> 32);
+}
+
+u64 platform_get_absolute_time_ns() {
+    const platform_clock_state* clock = platform_clock();
+    if (!clock->use_tsc) {
+        return platform_clock_raw_ns();
+    }
+    return clock->base_ns + platform_ticks_to_ns(platform_get_ticks() - clock->base_ticks);
+}
+
+f64 platform_get_absolute_time() {
+    return (f64)platform_get_absolute_time_ns() * 0.000000001;
+}
+
+// Bounds of the stretch at the end of a wait that is spun rather than slept.
+#define PLATFORM_SLEEP_MARGIN_MIN_NS 20000ull
+#define PLATFORM_SLEEP_MARGIN_MAX_NS 4000000ull
+
+// How late the OS has been waking this thread from a sleep, as estimated so far.
+static thread_local u64 sleep_margin_ns = 1000000ull;
+
+// Grows at once to cover a late wake-up and shrinks slowly, so one punctual wake-up
+// does not undo it.
+static void platform_update_sleep_margin(u64 late_ns) {
+    if (late_ns > sleep_margin_ns) {
+        sleep_margin_ns = late_ns;
+    } else {
+        sleep_margin_ns -= (sleep_margin_ns - late_ns) / 8;
+    }
+    if (sleep_margin_ns < PLATFORM_SLEEP_MARGIN_MIN_NS) {
+        sleep_margin_ns = PLATFORM_SLEEP_MARGIN_MIN_NS;
+    } else if (sleep_margin_ns > PLATFORM_SLEEP_MARGIN_MAX_NS) {
+        sleep_margin_ns = PLATFORM_SLEEP_MARGIN_MAX_NS;
+    }
+}
+
+void platform_sleep_until(u64 deadline_ns) {
+    u64 now_ns = platform_get_absolute_time_ns();
+    if (now_ns + sleep_margin_ns < deadline_ns) {
+        u64 sleep_ns = deadline_ns - now_ns - sleep_margin_ns;
+
+        // clock_nanosleep cannot sleep on CLOCK_MONOTONIC_RAW, so wake on the same
+        // interval of CLOCK_MONOTONIC. An absolute wake time is not pushed back by
+        // signals interrupting the sleep.
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        u64 wake_ns = (u64)wake.tv_sec * 1000000000ull + (u64)wake.tv_nsec + sleep_ns;
+        wake.tv_sec = (time_t)(wake_ns / 1000000000ull);
+        wake.tv_nsec = (long)(wake_ns % 1000000000ull);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, 0) == EINTR) {
+        }
+
+        u64 woke_ns = platform_get_absolute_time_ns();
+        u64 target_ns = now_ns + sleep_ns;
+        platform_update_sleep_margin(woke_ns > target_ns ? woke_ns - target_ns : 0);
+    }
+
+    while (platform_get_absolute_time_ns() < deadline_ns) {
+        platform_cpu_relax();
+    }
 }
 
 void platform_sleep(u64 ms) {
@@ -307,6 +809,312 @@ void platform_sleep(u64 ms) {
 #endif
 }
 
+// Threading
+
+STATIC_ASSERT(sizeof(pthread_mutex_t) <= sizeof(platform_mutex), "platform_mutex is too small for pthread_mutex_t.");
+STATIC_ASSERT(sizeof(sem_t) <= sizeof(platform_semaphore), "platform_semaphore is too small for sem_t.");
+STATIC_ASSERT(sizeof(pthread_cond_t) <= sizeof(platform_condition), "platform_condition is too small for pthread_cond_t.");
+
+// What a new thread needs to start; freed by the thread once it has read it.
+typedef struct platform_thread_start {
+    PFN_thread_start start;
+    void* params;
+} platform_thread_start;
+
+static void* platform_thread_entry(void* arg) {
+    platform_thread_start start = *(platform_thread_start*)arg;
+    platform_free(arg, FALSE);
+    return (void*)(u64)start.start(start.params);
+}
+
+// Linux limits thread names to 15 characters.
+static void platform_set_thread_name(pthread_t thread, const char* name) {
+    char short_name[16];
+    strncpy(short_name, name, sizeof(short_name) - 1);
+    short_name[sizeof(short_name) - 1] = 0;
+    pthread_setname_np(thread, short_name);
+}
+
+b8 platform_thread_create(PFN_thread_start start, void* params, const char* name, platform_thread* out_thread) {
+    platform_thread_start* start_block = (platform_thread_start*)platform_allocate(sizeof(platform_thread_start), FALSE);
+    if (!start_block) {
+        KERROR("Failed to create thread '%s': out of memory", name ? name : "");
+        return FALSE;
+    }
+    start_block->start = start;
+    start_block->params = params;
+
+    pthread_t thread;
+    i32 result = pthread_create(&thread, 0, platform_thread_entry, start_block);
+    if (result != 0) {
+        KERROR("Failed to create thread '%s': %s", name ? name : "", strerror(result));
+        platform_free(start_block, FALSE);
+        return FALSE;
+    }
+    if (name) {
+        platform_set_thread_name(thread, name);
+    }
+    out_thread->handle = (u64)thread;
+    out_thread->thread_id = (u64)thread;
+    return TRUE;
+}
+
+b8 platform_thread_join(platform_thread* thread) {
+    if (pthread_join((pthread_t)thread->handle, 0) != 0) {
+        return FALSE;
+    }
+    thread->handle = 0;
+    thread->thread_id = 0;
+    return TRUE;
+}
+
+b8 platform_thread_set_affinity(platform_thread* thread, u64 processor_mask) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (u32 cpu = 0; cpu < 64; ++cpu) {
+        if (processor_mask & (1ull << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    pthread_t target = thread ? (pthread_t)thread->handle : pthread_self();
+    return pthread_setaffinity_np(target, sizeof(set), &set) == 0;
+}
+
+void platform_thread_set_current_name(const char* name) {
+    platform_set_thread_name(pthread_self(), name);
+}
+
+u64 platform_get_current_thread_id() {
+    return (u64)pthread_self();
+}
+
+b8 platform_mutex_create(platform_mutex* mutex) {
+    return pthread_mutex_init((pthread_mutex_t*)mutex->internal_data, 0) == 0;
+}
+
+void platform_mutex_destroy(platform_mutex* mutex) {
+    pthread_mutex_destroy((pthread_mutex_t*)mutex->internal_data);
+}
+
+void platform_mutex_lock(platform_mutex* mutex) {
+    pthread_mutex_lock((pthread_mutex_t*)mutex->internal_data);
+}
+
+b8 platform_mutex_try_lock(platform_mutex* mutex) {
+    return pthread_mutex_trylock((pthread_mutex_t*)mutex->internal_data) == 0;
+}
+
+void platform_mutex_unlock(platform_mutex* mutex) {
+    pthread_mutex_unlock((pthread_mutex_t*)mutex->internal_data);
+}
+
+// The time on the given clock timeout_ms from now, for the waits that take absolute times.
+// Waits use CLOCK_MONOTONIC where they can, so setting the wall clock does not stretch or
+// cut them short.
+static struct timespec platform_timeout_to_deadline(clockid_t clock, u64 timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(clock, &deadline);
+    u64 ns = (u64)deadline.tv_nsec + (timeout_ms % 1000) * 1000000ull;
+    deadline.tv_sec += (time_t)(timeout_ms / 1000 + ns / 1000000000ull);
+    deadline.tv_nsec = (long)(ns % 1000000000ull);
+    return deadline;
+}
+
+b8 platform_semaphore_create(platform_semaphore* semaphore, u32 initial_count) {
+    return sem_init((sem_t*)semaphore->internal_data, 0, initial_count) == 0;
+}
+
+void platform_semaphore_destroy(platform_semaphore* semaphore) {
+    sem_destroy((sem_t*)semaphore->internal_data);
+}
+
+void platform_semaphore_signal(platform_semaphore* semaphore) {
+    sem_post((sem_t*)semaphore->internal_data);
+}
+
+b8 platform_semaphore_wait(platform_semaphore* semaphore, u64 timeout_ms) {
+    sem_t* sem = (sem_t*)semaphore->internal_data;
+    i32 result;
+    if (timeout_ms == PLATFORM_WAIT_INFINITE) {
+        while ((result = sem_wait(sem)) != 0 && errno == EINTR) {
+        }
+    } else {
+#if KPLATFORM_SEM_CLOCKWAIT
+        struct timespec deadline = platform_timeout_to_deadline(CLOCK_MONOTONIC, timeout_ms);
+        while ((result = sem_clockwait(sem, CLOCK_MONOTONIC, &deadline)) != 0 && errno == EINTR) {
+        }
+#else
+        // Older C libraries only wait against the wall clock.
+        struct timespec deadline = platform_timeout_to_deadline(CLOCK_REALTIME, timeout_ms);
+        while ((result = sem_timedwait(sem, &deadline)) != 0 && errno == EINTR) {
+        }
+#endif
+    }
+    return result == 0;
+}
+
+b8 platform_condition_create(platform_condition* condition) {
+    // Timed waits measure against CLOCK_MONOTONIC rather than the default wall clock.
+    pthread_condattr_t attributes;
+    if (pthread_condattr_init(&attributes) != 0) {
+        return FALSE;
+    }
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    b8 result = pthread_cond_init((pthread_cond_t*)condition->internal_data, &attributes) == 0;
+    pthread_condattr_destroy(&attributes);
+    return result;
+}
+
+void platform_condition_destroy(platform_condition* condition) {
+    pthread_cond_destroy((pthread_cond_t*)condition->internal_data);
+}
+
+b8 platform_condition_wait(platform_condition* condition, platform_mutex* mutex, u64 timeout_ms) {
+    pthread_cond_t* cond = (pthread_cond_t*)condition->internal_data;
+    pthread_mutex_t* native_mutex = (pthread_mutex_t*)mutex->internal_data;
+    if (timeout_ms == PLATFORM_WAIT_INFINITE) {
+        return pthread_cond_wait(cond, native_mutex) == 0;
+    }
+    struct timespec deadline = platform_timeout_to_deadline(CLOCK_MONOTONIC, timeout_ms);
+    return pthread_cond_timedwait(cond, native_mutex, &deadline) == 0;
+}
+
+void platform_condition_signal(platform_condition* condition) {
+    pthread_cond_signal((pthread_cond_t*)condition->internal_data);
+}
+
+void platform_condition_broadcast(platform_condition* condition) {
+    pthread_cond_broadcast((pthread_cond_t*)condition->internal_data);
+}
+
+// Reads a small text file of sysfs into buffer. Returns FALSE if it cannot be read.
+static b8 platform_read_sysfs(const char* path, char* buffer, u32 size) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return FALSE;
+    }
+    b8 read = fgets(buffer, (i32)size, file) != 0;
+    fclose(file);
+    return read;
+}
+
+// Parses the next "a" or "a-b" range of a sysfs processor list such as "0-3,5,7-9".
+// Returns FALSE at the end of the list.
+static b8 platform_next_cpu_range(const char** cursor, u32* out_first, u32* out_last) {
+    const char* text = *cursor;
+    while (*text == ',') {
+        text++;
+    }
+    if (*text < '0' || *text > '9') {
+        return FALSE;
+    }
+    char* end;
+    *out_first = (u32)strtoul(text, &end, 10);
+    *out_last = *out_first;
+    if (*end == '-') {
+        *out_last = (u32)strtoul(end + 1, &end, 10);
+    }
+    *cursor = end;
+    return TRUE;
+}
+
+static int platform_compare_u64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+void platform_get_cpu_info(platform_cpu_info* out_info) {
+    memset(out_info, 0, sizeof(platform_cpu_info));
+
+    // Online processors need not be numbered 0..n-1, so walk the kernel's list of them.
+    char online[4096];
+    if (!platform_read_sysfs("/sys/devices/system/cpu/online", online, sizeof(online))) {
+        i64 count = sysconf(_SC_NPROCESSORS_ONLN);
+        snprintf(online, sizeof(online), "0-%u", count > 1 ? (u32)(count - 1) : 0);
+    }
+    const char* cursor = online;
+    u32 first;
+    u32 last;
+    u32 first_online = 0xFFFFFFFFu;
+    while (platform_next_cpu_range(&cursor, &first, &last)) {
+        if (last >= first) {
+            out_info->logical_processors += last - first + 1;
+            first_online = first < first_online ? first : first_online;
+        }
+    }
+    if (out_info->logical_processors == 0) {
+        out_info->logical_processors = 1;
+        first_online = 0;
+    }
+
+    // A physical core is a distinct (package, core) pair among the online processors.
+    // Gather the pairs, then count the distinct ones after sorting.
+    char path[128];
+    char text[64];
+    // Without memory for the pairs, physical_cores falls back to the logical count below.
+    u64* cores = (u64*)platform_allocate(sizeof(u64) * out_info->logical_processors, FALSE);
+    u32 core_ids = 0;
+    cursor = online;
+    while (cores && platform_next_cpu_range(&cursor, &first, &last)) {
+        for (u32 cpu = first; cpu <= last && core_ids < out_info->logical_processors; ++cpu) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+            if (!platform_read_sysfs(path, text, sizeof(text))) {
+                continue;
+            }
+            u64 core = strtoull(text, 0, 10);
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+            if (platform_read_sysfs(path, text, sizeof(text))) {
+                core |= strtoull(text, 0, 10) << 32;
+            }
+            cores[core_ids++] = core;
+        }
+    }
+    u32 core_count = 0;
+    if (cores) {
+        qsort(cores, core_ids, sizeof(u64), platform_compare_u64);
+        for (u32 i = 0; i < core_ids; ++i) {
+            if (i == 0 || cores[i] != cores[i - 1]) {
+                core_count++;
+            }
+        }
+        platform_free(cores, FALSE);
+    }
+    out_info->physical_cores = core_count ? core_count : out_info->logical_processors;
+
+    // The caches of the first online processor; the others match on every common machine.
+    for (u32 index = 0; index < 8; ++index) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/type", first_online, index);
+        if (!platform_read_sysfs(path, text, sizeof(text))) {
+            break;
+        }
+        if (strncmp(text, "Instruction", 11) == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", first_online, index);
+        u32 level = platform_read_sysfs(path, text, sizeof(text)) ? (u32)strtoul(text, 0, 10) : 0;
+        // Sizes read as "48K" or "32M".
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/size", first_online, index);
+        u32 size = 0;
+        if (platform_read_sysfs(path, text, sizeof(text))) {
+            char* unit;
+            size = (u32)strtoul(text, &unit, 10);
+            size *= *unit == 'K' ? 1024 : (*unit == 'M' ? 1024 * 1024 : 1);
+        }
+        if (level == 1) {
+            out_info->l1_data_cache_size = size;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/coherency_line_size", first_online, index);
+            if (platform_read_sysfs(path, text, sizeof(text))) {
+                out_info->cache_line_size = (u32)strtoul(text, 0, 10);
+            }
+        } else if (level == 2) {
+            out_info->l2_cache_size = size;
+        } else if (level == 3) {
+            out_info->l3_cache_size = size;
+        }
+    }
+}
+
 // Key translation
 keys translate_keycode(u32 x_keycode) {
     switch (x_keycode) {
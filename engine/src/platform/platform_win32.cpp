@@ -4,6 +4,7 @@
 #if KPLATFORM_WINDOWS
 
 #include "core/logger.h"
+#include "core/event.h"
 #include "core/input.h"
 
 #include <windows.h>
@@ -13,13 +14,13 @@
 typedef struct internal_state {
     HINSTANCE h_instance;
     HWND hwnd;
+    // No window; pumping messages does nothing.
+    b8 headless;
 } internal_state;
 
-// Clock
-static f64 clock_frequency;
-static LARGE_INTEGER start_time;
 
 LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARAM l_param);
+static void platform_release_sleep_timer();
 
 b8 platform_startup(
     platform_state *plat_state,
@@ -27,9 +28,23 @@ b8 platform_startup(
     i32 x,
     i32 y,
     i32 width,
-    i32 height) {
+    i32 height,
+    b8 headless,
+    b8 pump_thread) {
     plat_state->internal_state = malloc(sizeof(internal_state));
     internal_state *state = (internal_state *)plat_state->internal_state;
+    memset(state, 0, sizeof(internal_state));
+
+    if (headless) {
+        state->headless = TRUE;
+        KINFO("Platform started headless.");
+        return TRUE;
+    }
+
+    // A window's messages can only be read on the thread that created it.
+    if (pump_thread) {
+        KWARN("A pump thread is not supported on Windows, pumping messages on the main thread.");
+    }
 
     state->h_instance = GetModuleHandleA(0);
 
@@ -103,12 +118,6 @@ b8 platform_startup(
     // If initially maximized, use SW_SHOWMAXIMIZED : SW_MAXIMIZE
     ShowWindow(state->hwnd, show_window_command_flags);
 
-    // Clock setup
-    LARGE_INTEGER frequency;
-    QueryPerformanceFrequency(&frequency);
-    clock_frequency = 1.0 / (f64)frequency.QuadPart;
-    QueryPerformanceCounter(&start_time);
-
     return TRUE;
 }
 
@@ -120,9 +129,15 @@ void platform_shutdown(platform_state *plat_state) {
         DestroyWindow(state->hwnd);
         state->hwnd = 0;
     }
+    platform_release_sleep_timer();
 }
 
 b8 platform_pump_messages(platform_state *plat_state) {
+    internal_state *state = (internal_state *)plat_state->internal_state;
+    if (state->headless) {
+        return TRUE;
+    }
+
     MSG message;
     while (PeekMessageA(&message, NULL, 0, 0, PM_REMOVE)) {
         TranslateMessage(&message);
@@ -133,11 +148,74 @@ b8 platform_pump_messages(platform_state *plat_state) {
 }
 
 void *platform_allocate(u64 size, b8 aligned) {
+    if (aligned) {
+        return platform_allocate_aligned(size, PLATFORM_DEFAULT_ALIGNMENT);
+    }
     return malloc(size);
 }
 
+void *platform_allocate_aligned(u64 size, u64 alignment) {
+    return _aligned_malloc(size, alignment);
+}
+
 void platform_free(void *block, b8 aligned) {
-    free(block);
+    // Blocks from _aligned_malloc must not be handed to free() and vice versa.
+    if (aligned) {
+        _aligned_free(block);
+    } else {
+        free(block);
+    }
+}
+
+void *platform_allocate_pages(u64 size, b8 huge_pages) {
+    if (huge_pages) {
+        // Large pages need the SeLockMemoryPrivilege; fall back to regular pages without it.
+        SIZE_T large_page_size = GetLargePageMinimum();
+        if (large_page_size) {
+            SIZE_T length = (size + large_page_size - 1) & ~(large_page_size - 1);
+            void *block = VirtualAlloc(0, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (block) {
+                return block;
+            }
+        }
+    }
+    return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void platform_free_pages(void *block, u64 size, b8 huge_pages) {
+    if (block) {
+        // MEM_RELEASE frees the whole reservation and requires a size of 0.
+        VirtualFree(block, 0, MEM_RELEASE);
+    }
+}
+
+u64 platform_get_page_size() {
+    static u64 page_size = 0;
+    if (!page_size) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_size = info.dwPageSize;
+    }
+    return page_size;
+}
+
+void *platform_reserve_memory(u64 size) {
+    return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+b8 platform_commit_memory(void *block, u64 size) {
+    return VirtualAlloc(block, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+}
+
+void platform_decommit_memory(void *block, u64 size) {
+    VirtualFree(block, size, MEM_DECOMMIT);
+}
+
+void platform_release_memory(void *block, u64 size) {
+    if (block) {
+        // MEM_RELEASE frees the whole reservation and requires a size of 0.
+        VirtualFree(block, 0, MEM_RELEASE);
+    }
 }
 
 void *platform_zero_memory(void *block, u64 size) {
@@ -174,16 +252,311 @@ void platform_console_write_error(const char *message, u8 colour) {
     WriteConsoleA(GetStdHandle(STD_ERROR_HANDLE), message, (DWORD)length, number_written, 0);
 }
 
-f64 platform_get_absolute_time() {
+// The performance counter frequency in ticks per second. Fixed at boot, so it is read
+// once, on first use, which may come before platform_startup.
+static inline u64 platform_clock_frequency() {
+    static const u64 frequency = [] {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return (u64)value.QuadPart;
+    }();
+    return frequency;
+}
+
+// QueryPerformanceCounter already uses the invariant TSC where Windows trusts it.
+u64 platform_get_ticks() {
     LARGE_INTEGER now_time;
     QueryPerformanceCounter(&now_time);
-    return (f64)now_time.QuadPart * clock_frequency;
+    return (u64)now_time.QuadPart;
+}
+
+u64 platform_ticks_to_ns(u64 ticks) {
+    // Whole seconds and the remainder apart, so the multiplication cannot overflow.
+    u64 frequency = platform_clock_frequency();
+    return (ticks / frequency) * 1000000000ull + (ticks % frequency) * 1000000000ull / frequency;
+}
+
+u64 platform_get_absolute_time_ns() {
+    return platform_ticks_to_ns(platform_get_ticks());
+}
+
+f64 platform_get_absolute_time() {
+    return (f64)platform_get_absolute_time_ns() * 0.000000001;
+}
+
+// Available since Windows 10 1803; older SDKs lack the definition.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Bounds of the stretch at the end of a wait that is spun rather than slept.
+#define PLATFORM_SLEEP_MARGIN_MIN_NS 20000ull
+#define PLATFORM_SLEEP_MARGIN_MAX_NS 4000000ull
+
+// How late the OS has been waking this thread from a sleep, as estimated so far, and
+// the thread's waitable timer.
+static thread_local u64 sleep_margin_ns = 1000000ull;
+static thread_local HANDLE sleep_timer = 0;
+
+// Grows at once to cover a late wake-up and shrinks slowly, so one punctual wake-up
+// does not undo it.
+static void platform_update_sleep_margin(u64 late_ns) {
+    if (late_ns > sleep_margin_ns) {
+        sleep_margin_ns = late_ns;
+    } else {
+        sleep_margin_ns -= (sleep_margin_ns - late_ns) / 8;
+    }
+    if (sleep_margin_ns < PLATFORM_SLEEP_MARGIN_MIN_NS) {
+        sleep_margin_ns = PLATFORM_SLEEP_MARGIN_MIN_NS;
+    } else if (sleep_margin_ns > PLATFORM_SLEEP_MARGIN_MAX_NS) {
+        sleep_margin_ns = PLATFORM_SLEEP_MARGIN_MAX_NS;
+    }
+}
+
+void platform_sleep_until(u64 deadline_ns) {
+    u64 now_ns = platform_get_absolute_time_ns();
+    if (now_ns + sleep_margin_ns < deadline_ns) {
+        u64 sleep_ns = deadline_ns - now_ns - sleep_margin_ns;
+
+        // A high resolution timer wakes within a fraction of a millisecond, where Sleep
+        // is bound to the scheduler tick. Fall back to a plain timer where unsupported.
+        if (!sleep_timer) {
+            sleep_timer = CreateWaitableTimerExW(0, 0, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+            if (!sleep_timer) {
+                sleep_timer = CreateWaitableTimerExW(0, 0, 0, TIMER_ALL_ACCESS);
+            }
+        }
+
+        // Negative due times are relative, in 100ns units.
+        LARGE_INTEGER due_time;
+        due_time.QuadPart = -(LONGLONG)(sleep_ns / 100);
+        if (sleep_timer && SetWaitableTimer(sleep_timer, &due_time, 0, 0, 0, FALSE)) {
+            WaitForSingleObject(sleep_timer, INFINITE);
+        } else {
+            Sleep((DWORD)(sleep_ns / 1000000));
+        }
+
+        u64 woke_ns = platform_get_absolute_time_ns();
+        u64 target_ns = now_ns + sleep_ns;
+        platform_update_sleep_margin(woke_ns > target_ns ? woke_ns - target_ns : 0);
+    }
+
+    while (platform_get_absolute_time_ns() < deadline_ns) {
+        platform_cpu_relax();
+    }
+}
+
+// Closes the calling thread's waitable timer, if it made one. Kernel handles are not
+// closed with the thread, so every thread that may have slept calls this before exiting.
+static void platform_release_sleep_timer() {
+    if (sleep_timer) {
+        CloseHandle(sleep_timer);
+        sleep_timer = 0;
+    }
 }
 
 void platform_sleep(u64 ms) {
     Sleep(ms);
 }
 
+// Threading
+
+STATIC_ASSERT(sizeof(SRWLOCK) <= sizeof(platform_mutex), "platform_mutex is too small for SRWLOCK.");
+STATIC_ASSERT(sizeof(HANDLE) <= sizeof(platform_semaphore), "platform_semaphore is too small for a HANDLE.");
+STATIC_ASSERT(sizeof(CONDITION_VARIABLE) <= sizeof(platform_condition), "platform_condition is too small for CONDITION_VARIABLE.");
+
+// What a new thread needs to start; freed by the thread once it has read it.
+typedef struct platform_thread_start {
+    PFN_thread_start start;
+    void *params;
+} platform_thread_start;
+
+static DWORD WINAPI platform_thread_entry(LPVOID arg) {
+    platform_thread_start start = *(platform_thread_start *)arg;
+    platform_free(arg, FALSE);
+    u32 result = start.start(start.params);
+    platform_release_sleep_timer();
+    return (DWORD)result;
+}
+
+// SetThreadDescription exists from Windows 10 1607, so it is looked up at run time.
+typedef HRESULT(WINAPI *PFN_SetThreadDescription)(HANDLE thread, PCWSTR description);
+
+static void platform_set_thread_name(HANDLE thread, const char *name) {
+    static PFN_SetThreadDescription set_thread_description =
+        (PFN_SetThreadDescription)(void *)GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if (!set_thread_description) {
+        return;
+    }
+    wchar_t wide_name[64];
+    if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, 64) > 0) {
+        set_thread_description(thread, wide_name);
+    }
+}
+
+b8 platform_thread_create(PFN_thread_start start, void *params, const char *name, platform_thread *out_thread) {
+    platform_thread_start *start_block = (platform_thread_start *)platform_allocate(sizeof(platform_thread_start), FALSE);
+    if (!start_block) {
+        KERROR("Failed to create thread '%s': out of memory", name ? name : "");
+        return FALSE;
+    }
+    start_block->start = start;
+    start_block->params = params;
+
+    DWORD thread_id = 0;
+    HANDLE handle = CreateThread(0, 0, platform_thread_entry, start_block, 0, &thread_id);
+    if (!handle) {
+        KERROR("Failed to create thread '%s': error %lu", name ? name : "", GetLastError());
+        platform_free(start_block, FALSE);
+        return FALSE;
+    }
+    if (name) {
+        platform_set_thread_name(handle, name);
+    }
+    out_thread->handle = (u64)handle;
+    out_thread->thread_id = thread_id;
+    return TRUE;
+}
+
+b8 platform_thread_join(platform_thread *thread) {
+    HANDLE handle = (HANDLE)thread->handle;
+    if (WaitForSingleObject(handle, INFINITE) != WAIT_OBJECT_0) {
+        return FALSE;
+    }
+    CloseHandle(handle);
+    thread->handle = 0;
+    thread->thread_id = 0;
+    return TRUE;
+}
+
+b8 platform_thread_set_affinity(platform_thread *thread, u64 processor_mask) {
+    HANDLE handle = thread ? (HANDLE)thread->handle : GetCurrentThread();
+    // Name the group explicitly; SetThreadAffinityMask would apply the mask to whichever
+    // group the thread happens to be in.
+    GROUP_AFFINITY affinity;
+    memset(&affinity, 0, sizeof(affinity));
+    affinity.Mask = (KAFFINITY)processor_mask;
+    affinity.Group = 0;
+    return SetThreadGroupAffinity(handle, &affinity, 0) != 0;
+}
+
+void platform_thread_set_current_name(const char *name) {
+    platform_set_thread_name(GetCurrentThread(), name);
+}
+
+u64 platform_get_current_thread_id() {
+    return GetCurrentThreadId();
+}
+
+// Slim reader/writer locks need no kernel object and take no syscall when uncontended.
+b8 platform_mutex_create(platform_mutex *mutex) {
+    InitializeSRWLock((SRWLOCK *)mutex->internal_data);
+    return TRUE;
+}
+
+void platform_mutex_destroy(platform_mutex *mutex) {
+    // SRW locks own no resources.
+}
+
+void platform_mutex_lock(platform_mutex *mutex) {
+    AcquireSRWLockExclusive((SRWLOCK *)mutex->internal_data);
+}
+
+b8 platform_mutex_try_lock(platform_mutex *mutex) {
+    return TryAcquireSRWLockExclusive((SRWLOCK *)mutex->internal_data) != 0;
+}
+
+void platform_mutex_unlock(platform_mutex *mutex) {
+    ReleaseSRWLockExclusive((SRWLOCK *)mutex->internal_data);
+}
+
+// Waits longer than a DWORD of milliseconds are as good as infinite.
+static DWORD platform_timeout_to_dword(u64 timeout_ms) {
+    return timeout_ms >= (u64)INFINITE ? INFINITE : (DWORD)timeout_ms;
+}
+
+b8 platform_semaphore_create(platform_semaphore *semaphore, u32 initial_count) {
+    HANDLE handle = CreateSemaphoreA(0, (LONG)initial_count, 0x7FFFFFFF, 0);
+    *(HANDLE *)semaphore->internal_data = handle;
+    return handle != 0;
+}
+
+void platform_semaphore_destroy(platform_semaphore *semaphore) {
+    CloseHandle(*(HANDLE *)semaphore->internal_data);
+}
+
+void platform_semaphore_signal(platform_semaphore *semaphore) {
+    ReleaseSemaphore(*(HANDLE *)semaphore->internal_data, 1, 0);
+}
+
+b8 platform_semaphore_wait(platform_semaphore *semaphore, u64 timeout_ms) {
+    return WaitForSingleObject(*(HANDLE *)semaphore->internal_data, platform_timeout_to_dword(timeout_ms)) == WAIT_OBJECT_0;
+}
+
+b8 platform_condition_create(platform_condition *condition) {
+    InitializeConditionVariable((CONDITION_VARIABLE *)condition->internal_data);
+    return TRUE;
+}
+
+void platform_condition_destroy(platform_condition *condition) {
+    // Condition variables own no resources.
+}
+
+b8 platform_condition_wait(platform_condition *condition, platform_mutex *mutex, u64 timeout_ms) {
+    return SleepConditionVariableSRW((CONDITION_VARIABLE *)condition->internal_data, (SRWLOCK *)mutex->internal_data,
+                                     platform_timeout_to_dword(timeout_ms), 0) != 0;
+}
+
+void platform_condition_signal(platform_condition *condition) {
+    WakeConditionVariable((CONDITION_VARIABLE *)condition->internal_data);
+}
+
+void platform_condition_broadcast(platform_condition *condition) {
+    WakeAllConditionVariable((CONDITION_VARIABLE *)condition->internal_data);
+}
+
+void platform_get_cpu_info(platform_cpu_info *out_info) {
+    memset(out_info, 0, sizeof(platform_cpu_info));
+
+    // The extended query reports every processor group, where the plain one only sees
+    // the group of the calling thread. Entries vary in size and are walked by their Size.
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, 0, &length);
+    u8 *entries = (u8 *)platform_allocate(length, FALSE);
+    if (entries && GetLogicalProcessorInformationEx(RelationAll, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)entries, &length)) {
+        for (DWORD offset = 0; offset < length;) {
+            SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *entry = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)(entries + offset);
+            if (entry->Relationship == RelationProcessorCore) {
+                out_info->physical_cores++;
+                for (WORD group = 0; group < entry->Processor.GroupCount; ++group) {
+                    out_info->logical_processors += (u32)__builtin_popcountll((u64)entry->Processor.GroupMask[group].Mask);
+                }
+            } else if (entry->Relationship == RelationCache && entry->Cache.Type != CacheInstruction) {
+                // Caches are reported once per instance; all instances of a level match.
+                if (entry->Cache.Level == 1) {
+                    out_info->l1_data_cache_size = entry->Cache.CacheSize;
+                    out_info->cache_line_size = entry->Cache.LineSize;
+                } else if (entry->Cache.Level == 2) {
+                    out_info->l2_cache_size = entry->Cache.CacheSize;
+                } else if (entry->Cache.Level == 3) {
+                    out_info->l3_cache_size = entry->Cache.CacheSize;
+                }
+            }
+            offset += entry->Size;
+        }
+    }
+    platform_free(entries, FALSE);
+
+    if (!out_info->logical_processors) {
+        SYSTEM_INFO system_info;
+        GetSystemInfo(&system_info);
+        out_info->logical_processors = system_info.dwNumberOfProcessors;
+    }
+    if (!out_info->physical_cores) {
+        out_info->physical_cores = out_info->logical_processors;
+    }
+}
+
 LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARAM l_param) {
     switch (msg) {
         case WM_ERASEBKGND:
@@ -197,12 +570,16 @@ LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARA
             return 0;
         case WM_SIZE: {
             // Get the updated size.
-            // RECT r;
-            // GetClientRect(hwnd, &r);
-            // u32 width = r.right - r.left;
-            // u32 height = r.bottom - r.top;
-
-            // TODO: Fire an event for window resize.
+            RECT r;
+            GetClientRect(hwnd, &r);
+            u32 width = r.right - r.left;
+            u32 height = r.bottom - r.top;
+
+            // Queue the event; a burst of resizes is coalesced to the last one.
+            event_context context;
+            context.data.u16[0] = (u16)width;
+            context.data.u16[1] = (u16)height;
+            event_post(EVENT_CODE_RESIZED, 0, context);
         } break;
         case WM_KEYDOWN:
         case WM_SYSKEYDOWN:
@@ -212,8 +589,9 @@ LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARA
             b8 pressed = (msg == WM_KEYDOWN || msg == WM_SYSKEYDOWN);
             keys key = (u16)w_param;
 
-            // Pass to the input subsystem for processing.
-            input_process_key(key, pressed);
+            // Pass to the input subsystem for processing. GetMessageTime is the OS timestamp
+            // of the message being processed.
+            input_process_key(key, pressed, (u32)GetMessageTime());
         } break;
         case WM_MOUSEMOVE: {
             // Mouse move
@@ -221,14 +599,14 @@ LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARA
             i32 y_position = GET_Y_LPARAM(l_param);
             
             // Pass over to the input subsystem.
-            input_process_mouse_move(x_position, y_position);
+            input_process_mouse_move(x_position, y_position, (u32)GetMessageTime());
         } break;
         case WM_MOUSEWHEEL: {
             i32 z_delta = GET_WHEEL_DELTA_WPARAM(w_param);
             if (z_delta != 0) {
                 // Flatten the input to an OS-independent (-1, 1)
                 z_delta = (z_delta < 0) ? -1 : 1;
-                input_process_mouse_wheel(z_delta);
+                input_process_mouse_wheel(z_delta, (u32)GetMessageTime());
             }
         } break;
         case WM_LBUTTONDOWN:
@@ -256,7 +634,7 @@ LRESULT CALLBACK win32_process_message(HWND hwnd, u32 msg, WPARAM w_param, LPARA
 
             // Pass over to the input subsystem.
             if (mouse_button != BUTTON_MAX_BUTTONS) {
-                input_process_button(mouse_button, pressed);
+                input_process_button(mouse_button, pressed, (u32)GetMessageTime());
             }
         } break;
     }
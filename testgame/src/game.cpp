@@ -1,15 +1,17 @@
 #include <core/logger.h>
+#include <core/kmemory.h>
 #include <game_types.h>
-#include <platform/platform.h>
 
 Game::Game() 
 {
-    state = platform_allocate(sizeof(game_state), FALSE);
+    state = 0;
 };
 
 b8 Game::initialize(Game* game_inst) {
     KDEBUG("game_initialize() called!");
-    return TRUE;
+    // Allocated here rather than in the constructor, which runs before the memory system is up.
+    state = kallocate(sizeof(game_state), MEMORY_TAG_GAME);
+    return state != 0;
 }
 
 b8 Game::update(Game* game_inst, f32 delta_time) {
@@ -21,4 +23,11 @@ b8 Game::render(Game* game_inst, f32 delta_time) {
 }
 
 void Game::on_resize(Game* game_inst, u32 width, u32 height) {
+}
+
+void Game::shutdown(Game* game_inst) {
+    if (state) {
+        kfree(state, sizeof(game_state), MEMORY_TAG_GAME);
+        state = 0;
+    }
 }
\ No newline at end of file